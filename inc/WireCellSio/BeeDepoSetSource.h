@@ -0,0 +1,52 @@
+/*
+  This component provides the depositions of BeeDepoSource as depo
+  sets instead of one depo at a time.
+
+  Each set holds the depos of one input file (or one group of merged
+  files) or, if "block_size" is nonzero, at most that many
+  consecutive depos of one.  Set
+  idents count from zero.  After the last set an EOS is sent.
+
+  All other configuration is as for BeeDepoSource.
+ */
+
+#ifndef WIRECELLSIO_BEEDEPOSETSOURCE
+#define WIRECELLSIO_BEEDEPOSETSOURCE
+
+#include "WireCellIface/IDepoSetSource.h"
+#include "WireCellIface/IConfigurable.h"
+#include "WireCellIface/ITerminal.h"
+#include "WireCellSio/BeeDepoSource.h"
+
+namespace WireCell {
+    namespace Sio {
+
+        class BeeDepoSetSource : public IDepoSetSource, public IConfigurable,
+                                 public ITerminal {
+        public:
+
+            BeeDepoSetSource();
+            virtual ~BeeDepoSetSource();
+
+            /// IDepoSetSource
+            virtual bool operator()(IDepoSet::pointer& out);
+
+            /// IConfigurable
+            virtual WireCell::Configuration default_configuration() const;
+            virtual void configure(const WireCell::Configuration& config);
+
+            /// ITerminal, report the metrics of the depo source.
+            virtual void finalize();
+
+        private:
+
+            BeeDepoSource m_source;
+            size_t m_block_size;
+            IDepo::vector m_depos; // current file
+            size_t m_next;         // first depo of next set
+            int m_count;
+            bool m_eos;
+        };
+    }
+}
+#endif
@@ -18,24 +18,68 @@
 "type":"truthDepo"
 }
 
-  The  "nq" and the non-array atributes are ignored.  
+  The  "nq" and the non-array atributes are ignored.  A "t" array of
+  depo times is also read if present.  Any of "t", "x", "y", "z" or
+  "q" missing from a file takes its value from "defaults", which by
+  default only gives "t" as 0.  A missing attribute with no default
+  is an error.
 
   The component is configured with a collection of input files.  These
   may be compressed JSON or Jsonnet files.  
 
+  With "readahead" set, up to that many of the following files are
+  decoded in background threads while the depos of the current file
+  are consumed.  File order is kept.
+
+  With "arena" set, the depos of one file are allocated together in a
+  few large blocks (see DepoArena) instead of one by one.  Blocks
+  are filled in the order the depos are emitted.
+
+  With "sort" set, each file's depos are emitted in time order, ties
+  kept in file order.  With "merge" set to N above 1, each N
+  consecutive files form one group whose sorted depos are merged
+  into a single time ordered stream, as for overlaying pile-up and
+  cosmics.  An EOS is then sent after each group instead of each file.
+
+  A file is decoded whole, as its columns must all be read to make
+  any depo and sorting needs all of them.  Each file of a group is
+  decoded before the group's first depo is emitted, so memory peaks
+  at the depos of the whole group.  It then falls as depos are
+  emitted and released downstream (a block at a time with "arena").
+
+  With "workers" set to N, N reader threads each own a slice of the
+  file list: worker w decodes files w, w+N, w+2N, ... in turn.  Each
+  keeps at most "readahead" (at least one) decoded files waiting.
+  The files are taken back from the workers in list order, so the
+  output is identical to a serial read.
+
+  File and depo counts, the time spent waiting on file decoding and
+  rates are reported at each EOS and at finalize (see Metrics).
 
  */
 
-#ifndef WIRECELLSIO_JSONDEPOSOURCE
-#define WIRECELLSIO_JSONDEPOSOURCE
+#ifndef WIRECELLSIO_BEEDEPOSOURCE
+#define WIRECELLSIO_BEEDEPOSOURCE
 
 #include "WireCellIface/IDepoSource.h"
 #include "WireCellIface/IConfigurable.h"
+#include "WireCellIface/ITerminal.h"
+#include "WireCellSio/Metrics.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 namespace WireCell {
     namespace Sio {
 
-        class BeeDepoSource : public IDepoSource, public IConfigurable {
+        class BeeDepoSource : public IDepoSource, public IConfigurable,
+                              public ITerminal {
         public:
         
             BeeDepoSource();
@@ -48,13 +92,61 @@ namespace WireCell {
             virtual WireCell::Configuration default_configuration() const;
             virtual void configure(const WireCell::Configuration& config);
 
+            /// ITerminal, report total metrics.
+            virtual void finalize();
+
+            /// Batch access, as used by BeeDepoSetSource.  Fill with
+            /// all depos of the next non-empty file (or group) and
+            /// return true or return false if no files remain.  Do
+            /// not mix with operator().
+            bool batch(IDepo::vector& depos);
 
         private:
 
+            // Return the depos of the next file.
+            IDepo::vector next_file();
+            // Load the next group with depos, false if none.
+            bool next_group();
+            // Next depo of the group in order, null if none left.
+            IDepo::pointer pop_group();
+            bool later(size_t a, size_t b) const;
+            bool more_files() const;
+
+            // A worker thread and the files it decodes.
+            struct Shard {
+                std::vector<std::string> filenames; // in list order
+                std::deque<IDepo::vector> done;     // decoded, not yet taken
+                std::exception_ptr error;
+                std::thread thread;
+            };
+            void start_shards();
+            void stop_shards();
+            void run_shard(Shard& shard);
+
             std::vector<std::string> m_filenames;
             std::string m_policy;
-            IDepo::vector m_depos; // current set of depos
-
+            size_t m_readahead;
+            bool m_arena;
+            std::map<std::string, double> m_defaults; // for missing columns
+            bool m_sorted;
+            size_t m_merge;     // files per group
+            // The depos of each file of the current group, the next
+            // of each to emit, and a min-heap of the files with any
+            // left, by time of that next depo.
+            std::vector<IDepo::vector> m_group;
+            std::vector<size_t> m_heads;
+            std::vector<size_t> m_heap;
+            bool m_in_group;    // emitting a group, EOS due at its end
+            std::deque< std::future<IDepo::vector> > m_pending; // in file order
+
+            size_t m_workers;
+            std::vector< std::unique_ptr<Shard> > m_shards;
+            size_t m_nsharded;  // files given to the shards
+            size_t m_ntaken;    // files taken back from the shards
+            std::mutex m_shard_mutex; // guards done, error and stop
+            std::condition_variable m_shard_cond;
+            bool m_shard_stop;
+            Metrics m_metrics;
 
         };
     }
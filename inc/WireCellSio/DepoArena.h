@@ -0,0 +1,46 @@
+/** Allocate the SimpleDepo objects of one batch from shared blocks.
+
+    Instead of one heap allocation (object plus control block) per
+    depo, depos are constructed in place in a block holding up to
+    "capacity" of them and the returned pointers share ownership of
+    that block.  A block is freed when the last depo made in it is
+    released.  A long lived depo thus keeps its whole block alive.
+
+    Depos made here must not hold a prior from the same arena, or
+    their block could never be freed.
+ */
+
+#ifndef WIRECELLSIO_DEPOARENA
+#define WIRECELLSIO_DEPOARENA
+
+#include "WireCellIface/SimpleDepo.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace WireCell {
+    namespace Sio {
+
+        class DepoArena {
+        public:
+            explicit DepoArena(size_t capacity) : m_capacity(capacity ? capacity : 1) { }
+
+            /// Construct a SimpleDepo from the arguments.
+            template<typename... Args>
+            IDepo::pointer make(Args&&... args) {
+                if (!m_block or m_block->size() == m_capacity) {
+                    m_block = std::make_shared< std::vector<SimpleDepo> >();
+                    m_block->reserve(m_capacity); // never reallocated
+                }
+                m_block->emplace_back(std::forward<Args>(args)...);
+                return IDepo::pointer(m_block, &m_block->back());
+            }
+
+        private:
+            size_t m_capacity;
+            std::shared_ptr< std::vector<SimpleDepo> > m_block;
+        };
+    }
+}
+#endif
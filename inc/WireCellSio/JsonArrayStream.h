@@ -0,0 +1,52 @@
+/** Read the elements of one array in a JSON document one at a time.
+
+    The document is read incrementally from a file, which may be
+    compressed (.gz or .bz2).  The array is found by a dot-separated
+    path of object keys from the top level; an empty path means the
+    document itself is the array.  Everything outside the array is
+    scanned over without being parsed.  Each element is then parsed
+    on its own by next(), so memory is that of one element rather
+    than of the whole document tree.
+
+    Jsonnet is not supported.  Errors throw IOError.
+ */
+
+#ifndef WIRECELLSIO_JSONARRAYSTREAM
+#define WIRECELLSIO_JSONARRAYSTREAM
+
+#include "WireCellUtil/Configuration.h"
+
+#include <istream>
+#include <memory>
+#include <string>
+
+namespace WireCell {
+    namespace Sio {
+
+        class JsonArrayStream {
+        public:
+            JsonArrayStream(const std::string& filename, const std::string& dotpath);
+            ~JsonArrayStream();
+
+            /// Parse the next element into the value and return
+            /// true, or return false at the end of the array.
+            bool next(Json::Value& element);
+
+        private:
+
+            int get();          // next char or EOF
+            int peek_nonws();   // skip white space, peek at next char
+            void expect(char want);
+            std::string read_key();
+            // Consume one value, appending its text to out if given.
+            void read_value(std::string* out);
+
+            std::string m_filename;
+            std::unique_ptr<std::istream> m_in;
+            std::unique_ptr<Json::CharReader> m_reader;
+            std::string m_text;
+            bool m_done;
+        };
+    }
+}
+#endif
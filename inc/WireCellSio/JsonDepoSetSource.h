@@ -0,0 +1,49 @@
+/*
+  This component provides the depositions of JsonDepoSource as depo
+  sets instead of one depo at a time.
+
+  A single set holds all depos of the file in time order or, if
+  "block_size" is nonzero, each set holds at most that many.  Set
+  idents count from zero.  After the last set an EOS is sent.
+
+  All other configuration is as for JsonDepoSource.
+ */
+
+#ifndef WIRECELLSIO_JSONDEPOSETSOURCE
+#define WIRECELLSIO_JSONDEPOSETSOURCE
+
+#include "WireCellIface/IDepoSetSource.h"
+#include "WireCellIface/IConfigurable.h"
+#include "WireCellIface/ITerminal.h"
+#include "WireCellSio/JsonDepoSource.h"
+
+namespace WireCell {
+    namespace Sio {
+
+        class JsonDepoSetSource : public IDepoSetSource, public IConfigurable,
+                                  public ITerminal {
+        public:
+
+            JsonDepoSetSource();
+            virtual ~JsonDepoSetSource();
+
+            /// IDepoSetSource
+            virtual bool operator()(IDepoSet::pointer& out);
+
+            /// IConfigurable
+            virtual WireCell::Configuration default_configuration() const;
+            virtual void configure(const WireCell::Configuration& config);
+
+            /// ITerminal, report the metrics of the depo source.
+            virtual void finalize();
+
+        private:
+
+            JsonDepoSource m_source;
+            size_t m_block_size;
+            int m_count;
+            bool m_eos;
+        };
+    }
+}
+#endif
@@ -12,6 +12,20 @@ or
   - q,s : energy deposition q in MeV along step of length s in cm (fixme: really?)
   - n : number of electrons.
 
+  With "stream" set true, the depos are parsed one at a time as the
+  file is read (see JsonArrayStream) instead of first loading the
+  whole document.  This requires plain (or .gz/.bz2) JSON.
+
+  Nothing is read at configure time.  The file is read on the first
+  call for a depo.  With "window" zero all depos are then sorted in
+  memory.  Otherwise they are sorted in runs of at most "window"
+  depos, each run but the last is spilled to a temporary file, and
+  depos are emitted by merging the runs.  Memory then scales with the
+  window and the number of runs rather than with the input.  Note
+  that "stream" is needed as well to avoid holding the whole document.
+
+  Load time, depo counts and rates are reported at EOS and finalize
+  (see Metrics).
 
  */
 
@@ -20,12 +34,21 @@ or
 
 #include "WireCellIface/IDepoSource.h"
 #include "WireCellIface/IConfigurable.h"
+#include "WireCellIface/ITerminal.h"
+#include "WireCellUtil/Logging.h"
+#include "WireCellSio/Metrics.h"
+
+#include <cstdio>
+#include <memory>
+#include <vector>
 
 namespace WireCell {
     namespace Sio {
 
         class JsonRecombinationAdaptor;
-        class JsonDepoSource : public IDepoSource, public IConfigurable {
+        class DepoArena;
+        class JsonDepoSource : public IDepoSource, public IConfigurable,
+                               public ITerminal {
         public:
         
             JsonDepoSource();
@@ -38,14 +61,54 @@ namespace WireCell {
             virtual WireCell::Configuration default_configuration() const;
             virtual void configure(const WireCell::Configuration& config);
 
+            /// ITerminal, report total metrics.
+            virtual void finalize();
+
             // local helper method 
             IDepo::pointer jdepo2idepo(Json::Value jdepo);
 
+            /// Batch access, as used by JsonDepoSetSource.  Fill with
+            /// the next maxn depos (all if zero) in time order and
+            /// return true or return false if none remain.  Do not
+            /// mix with operator().
+            bool batch(IDepo::vector& depos, size_t maxn=0);
+
         private:
+
+            // What is kept of a depo until it is emitted.
+            struct Record { double t, x, y, z, q; };
+            // A time ordered run, in a file or (the last) in memory.
+            struct Run {
+                FILE* fp;
+                Record head;
+            };
+
+            Record jdepo2record(Json::Value jdepo);
+            IDepo::pointer make_depo(const Record& rec);
+            void load();        // read the file into sorted runs
+            void spill();       // move m_window to a new run file
+            bool next(Record& rec);
+            void clear();
+
             JsonRecombinationAdaptor* m_adapter;
-            WireCell::IDepo::vector m_depos;
+            std::unique_ptr<DepoArena> m_arena;
+            std::string m_filename, m_dotpath;
+            bool m_stream;
+            size_t m_window_size;
+
+            // sorted, in memory run, consumed from m_pos
+            std::vector<Record> m_window;
+            size_t m_pos;
+            std::vector<Run> m_runs;
+            // min-heap over m_runs by head time
+            std::vector<size_t> m_heap;
+
+            bool m_loaded;
             bool m_eos;
 
+            size_t m_ndepos;    // depos emitted since EOS
+            Metrics m_metrics;
+            Log::logptr_t l;
 
         };
     }
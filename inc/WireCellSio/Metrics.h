@@ -0,0 +1,98 @@
+/** Collect and report performance metrics of one Sio component.
+
+    Values are kept by name as sums (counts, bytes, seconds) or as
+    peaks.  Rates are derived at report time from a count and a time.
+    The wall time from the first mark() after an EOS to that EOS is
+    reported as "span_s".
+    The values since the last EOS are logged by eos(), which then
+    folds them into running totals.  finalize() logs the totals.
+    Each report is one JSON object on one line, logged at info level
+    to the "io" logger, like:
+
+      {"component":"NumpyFrameSaver","event":"eos","frames":10,...}
+
+    Not thread safe.  Values measured in other threads should be
+    collected by the owning component and added from its thread.
+ */
+
+#ifndef WIRECELLSIO_METRICS
+#define WIRECELLSIO_METRICS
+
+#include "WireCellSio/NpzWriter.h"
+#include "WireCellUtil/Logging.h"
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace WireCell {
+    namespace Sio {
+
+        class Metrics {
+        public:
+            explicit Metrics(const std::string& component);
+
+            /// Add to a summed value.
+            void add(const std::string& name, double value);
+            /// Raise a peak value.
+            void peak(const std::string& name, double value);
+            /// Report "name" as the ratio of two other values.
+            void rate(const std::string& name, const std::string& count,
+                      const std::string& seconds);
+
+            /// Note activity, cheap enough to call per depo.
+            void mark() {
+                if (!m_marked) {
+                    m_marked = true;
+                    m_start = std::chrono::steady_clock::now();
+                }
+            }
+
+            /// Add the seconds from construction to destruction.
+            class Timer {
+            public:
+                Timer(Metrics& metrics, const std::string& name);
+                ~Timer();
+                Timer(const Timer&) = delete;
+                Timer& operator=(const Timer&) = delete;
+            private:
+                Metrics& m_metrics;
+                std::string m_name;
+                std::chrono::steady_clock::time_point m_start;
+            };
+
+            /// Log the values since the last EOS and fold them into
+            /// the totals.  Does nothing if there are none, even if
+            /// there was a mark().
+            void eos();
+
+            /// Log the totals, including any values since last EOS.
+            void finalize();
+
+        private:
+            struct Value {
+                double value;
+                bool is_peak;
+            };
+            typedef std::map<std::string, Value> values_t;
+
+            void fold();
+            void report(const std::string& event, const values_t& values, int neos) const;
+
+            std::string m_component;
+            values_t m_values, m_totals;
+            std::vector< std::tuple<std::string, std::string, std::string> > m_rates;
+            int m_neos;
+            bool m_marked;
+            std::chrono::steady_clock::time_point m_start;
+            Log::logptr_t l;
+        };
+
+        /// Add NpzWriter stats as entries, bytes_in, bytes_out,
+        /// compress_s, write_s and queue_wait_s.
+        void add_stats(Metrics& metrics, const NpzWriter::Stats& stats);
+    }
+}
+#endif
@@ -0,0 +1,63 @@
+/*
+  This component will provide depositions from a Numpy .npz file as
+  written by NumpyDepoSaver.
+
+  Each depo_data_N / depo_info_N pair (or its _chunkK parts) gives the
+  depos of one save N.  Saves are read in order of N.  The arrays are
+  used column-wise directly from the memory-mapped file (or inflated
+  one at a time if compressed) with no text parsing.  Each saved depo
+  is rebuilt with its chain of priors and only the depos of "gen" 0
+  are emitted, in their saved order.
+
+  Files from before the "prior" column was added to depo_info_N are
+  read by following each "child" index instead.
+
+  Save and depo counts, decode time and rates are reported at each
+  EOS and at finalize (see Metrics).
+ */
+
+#ifndef WIRECELLSIO_NPZDEPOSOURCE
+#define WIRECELLSIO_NPZDEPOSOURCE
+
+#include "WireCellIface/IDepoSource.h"
+#include "WireCellIface/IConfigurable.h"
+#include "WireCellIface/ITerminal.h"
+#include "WireCellSio/Metrics.h"
+
+#include <memory>
+
+namespace WireCell {
+    namespace Sio {
+
+        class NpzReader;
+        class NpzDepoSource : public IDepoSource, public IConfigurable,
+                              public ITerminal {
+        public:
+
+            NpzDepoSource();
+            virtual ~NpzDepoSource();
+
+            /// IDepoSource
+            virtual bool operator()(IDepo::pointer& out);
+
+            /// IConfigurable
+            virtual WireCell::Configuration default_configuration() const;
+            virtual void configure(const WireCell::Configuration& config);
+
+            /// ITerminal, report total metrics.
+            virtual void finalize();
+
+        private:
+
+            // Load the depos of one save.
+            void load(int save);
+
+            std::unique_ptr<NpzReader> m_reader;
+            std::vector<int> m_saves; // save numbers left to read, reversed
+            std::string m_policy;
+            IDepo::vector m_depos; // current set of depos, reversed
+            Metrics m_metrics;
+        };
+    }
+}
+#endif
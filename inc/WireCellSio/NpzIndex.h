@@ -0,0 +1,67 @@
+/** A JSON index written beside an npz file by the Numpy savers.
+
+    The index of "out.npz" is "out.npz.index.json" and holds:
+
+      {"npz": "out.npz",
+       "saves": [{"count": N, ..., "entries": ["frame_orig_N", ...]}, ...],
+       "entries": {"frame_orig_N": {"offset": 1234, "length": 5678, ...}, ...}}
+
+    Each save lists its entries plus what the saver knows of it, such
+    as the frame ident, time, tick and tags.  Each entry gives:
+
+    - offset :: byte offset of its .npy data in the npz file
+    - length :: bytes stored from offset
+    - size :: bytes of the .npy data
+    - header :: bytes of the .npy header
+    - method :: 0 if stored, 8 if deflated
+    - dtype, shape :: as in the .npy header
+
+    A reader can seek straight to the arrays of one save without the
+    zip directory.  If stored, the array data starts at offset plus
+    header.  Entries of a file that was written without an index are
+    not listed.
+ */
+
+#ifndef WIRECELLSIO_NPZINDEX
+#define WIRECELLSIO_NPZINDEX
+
+#include "WireCellSio/NpzWriter.h"
+#include "WireCellUtil/Configuration.h"
+
+#include <string>
+#include <vector>
+
+namespace WireCell {
+    namespace Sio {
+
+        class NpzIndex {
+        public:
+            /// Return the name of the index of an npz file.
+            static std::string sidecar(const std::string& npzname);
+
+            /// Return the index of an npz file or null if it has none.
+            static Configuration load(const std::string& npzname);
+
+            /// Index the given npz file.  If appending to an existing
+            /// archive (see NpzWriter::appending()) its index is kept
+            /// or, if this is not the file already indexed, loaded to
+            /// be extended.  Otherwise the index starts empty and
+            /// replaces any old one of the same name at once.
+            void open(const std::string& npzname, bool appending);
+
+            /// Add a save, which must hold "count" and "entries".
+            void add_save(const Configuration& jsave);
+
+            /// Add entries as returned by NpzWriter::take_entries().
+            void add_entries(const std::vector<NpzWriter::EntryInfo>& entries);
+
+            /// Write the index file.
+            void write() const;
+
+        private:
+            std::string m_npzname;
+            Configuration m_index;
+        };
+    }
+}
+#endif
@@ -0,0 +1,113 @@
+/** Read arrays from a Numpy .npz (zip) archive.
+
+    The file is memory mapped and only its zip central directory is
+    parsed on construction.  An entry is located on request.  A
+    "stored" (uncompressed) entry, as written by cnpy or NpzWriter, is
+    used in place from the mapping.  A "deflated" entry is inflated
+    into memory one entry at a time.
+
+    Data in the mapping need not be aligned for its type, so element
+    access is through value() or copy() rather than a typed pointer.
+ */
+
+#ifndef WIRECELLSIO_NPZREADER
+#define WIRECELLSIO_NPZREADER
+
+#include "WireCellUtil/cnpy.h"
+#include "WireCellUtil/Exceptions.h"
+
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+namespace WireCell {
+    namespace Sio {
+
+        class NpzReader {
+        public:
+
+            /// One .npy array.  It keeps the archive mapping (or its
+            /// own inflated buffer) alive.
+            struct Array {
+                std::string name;
+                std::string descr; // Numpy dtype, eg "<f4"
+                std::vector<size_t> shape;
+                bool fortran_order{false};
+                const char* data{nullptr};
+                size_t nbytes{0};
+                std::shared_ptr<const void> holder;
+
+                size_t num_vals() const {
+                    size_t n = 1;
+                    for (auto s : shape) { n *= s; }
+                    return n;
+                }
+                size_t word_size() const;
+
+                /// True if the dtype matches C++ type T.
+                template<typename T>
+                bool is_type() const {
+                    return descr.size() > 2
+                        and (descr[0] == '<' or descr[0] == '|')
+                        and descr[1] == cnpy::map_type(typeid(T))
+                        and word_size() == sizeof(T);
+                }
+
+                /// Return the ind'th element in storage order.
+                template<typename T>
+                T value(size_t ind) const {
+                    T ret;
+                    std::memcpy(&ret, data + ind*sizeof(T), sizeof(T));
+                    return ret;
+                }
+
+                /// Return all elements in storage order.
+                template<typename T>
+                std::vector<T> copy() const {
+                    if (!is_type<T>()) {
+                        THROW(ValueError() << errmsg{"NpzReader: array " + name
+                                    + " has dtype " + descr});
+                    }
+                    std::vector<T> ret(num_vals());
+                    std::memcpy(ret.data(), data, ret.size()*sizeof(T));
+                    return ret;
+                }
+            };
+
+            /// Map the file and read its zip directory.  Throws
+            /// IOError on failure.
+            explicit NpzReader(const std::string& filename);
+            ~NpzReader();
+
+            const std::string& filename() const { return m_filename; }
+
+            /// Names of all entries, without ".npy", in archive order.
+            std::vector<std::string> names() const;
+
+            bool has(const std::string& name) const;
+
+            /// Return the named array.  Throws IndexError if missing.
+            Array get(const std::string& name) const;
+
+        private:
+
+            struct Entry {
+                size_t offset;  // of local header
+                size_t csize, usize;
+                int method;
+            };
+
+            std::string m_filename;
+            std::shared_ptr<const void> m_map;
+            const char* m_base;
+            size_t m_size;
+            std::vector<std::string> m_order;
+            std::map<std::string, Entry> m_entries;
+        };
+
+    }
+}
+#endif
@@ -0,0 +1,232 @@
+/** Write arrays to a Numpy .npz (zip) archive held open between writes.
+
+    Calling cnpy::npz_save() in "a" mode reopens the archive and reads
+    and rewrites its zip central directory for every array saved.  This
+    writer instead keeps the file open, appends each array as a zip
+    local file entry as it arrives and keeps the central directory in
+    memory.  The directory and the zip footer are written by flush()
+    and by close() (also called on destruction).  After either the file
+    is a valid archive.  A later write() overwrites the old directory
+    in place so the cost of an append does not grow with the archive.
+
+    By default the bytes written are identical to what the equivalent
+    sequence of cnpy::npz_save(..., "a") calls would produce.  As with
+    cnpy, entries are "stored" (not compressed) and the archive is
+    limited to 4 GB.  If opened with a nonzero compression level,
+    entries are instead deflated (zip method 8) at that zlib level,
+    1 being fastest and 9 smallest, as numpy.savez_compressed does.
+
+    If opened with a nonzero queue depth, write() copies the array to
+    a bounded queue and returns.  A dedicated thread drains the queue
+    in order so the file contents do not change.  A write() to a full
+    queue blocks.  flush() and close() wait for the queue to drain.
+    An error in the I/O thread is rethrown by the next call.
+
+    Compression done by write() is serial, in the caller or the I/O
+    thread.  To compress several arrays at once, make each into a
+    Prepared entry with prepare() in its own thread and write() the
+    entries in the wanted order.  The writer then only appends their
+    bytes.  An entry prepared from a shared array and stored (level
+    0) holds the array itself rather than a copy.
+ */
+
+#ifndef WIRECELLSIO_NPZWRITER
+#define WIRECELLSIO_NPZWRITER
+
+#include "WireCellUtil/cnpy.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace WireCell {
+    namespace Sio {
+
+        class NpzWriter {
+        public:
+            NpzWriter();
+            ~NpzWriter();
+
+            NpzWriter(const NpzWriter&) = delete;
+            NpzWriter& operator=(const NpzWriter&) = delete;
+
+            /// Open the archive for appending.  Entries of an
+            /// existing archive are kept.  Any open archive is first
+            /// closed.  A nonzero queue_depth writes asynchronously,
+            /// buffering at most that many arrays.  A nonzero level
+            /// (1-9) deflates new entries.
+            void open(const std::string& filename, size_t queue_depth=0, int level=0);
+
+            /// Return the open() level for a codec name, "store" or
+            /// "deflate", and a deflate level.  Throws ValueError
+            /// for any other codec.
+            static int codec_level(const std::string& codec, int level);
+
+            /// Write central directory and footer and close the file.
+            void close();
+
+            /// Write central directory and footer, keep file open.
+            void flush();
+
+            /// What was written since open() or the last take_stats().
+            struct Stats {
+                size_t entries{0};
+                double bytes_in{0};     // array bytes with Numpy headers
+                double bytes_out{0};    // bytes written to the file
+                double compress_s{0};   // seconds deflating, in any thread
+                double write_s{0};      // seconds writing to the file
+                double queue_wait_s{0}; // seconds write() waited on a full queue
+            };
+            /// Return and reset the stats.
+            Stats take_stats();
+
+            /// Where an entry was written in the file.
+            struct EntryInfo {
+                std::string name;   // without ".npy"
+                size_t offset;      // of the .npy data in the file
+                size_t length;      // bytes stored from offset
+                size_t size;        // bytes of the .npy data
+                size_t header;      // bytes of its .npy header
+                int method;         // zip method, 0 stored or 8 deflated
+                std::string descr;  // Numpy dtype, eg "<f4"
+                std::vector<size_t> shape;
+            };
+            /// Return and forget the entries written since open() or
+            /// the last call, in file order.  Call after close() or
+            /// flush() to have all queued entries.
+            std::vector<EntryInfo> take_entries();
+
+            /// Bytes of the entries written to the file so far, kept
+            /// after close().  This first waits for any queued arrays
+            /// to be written.
+            size_t size();
+
+            bool is_open() const { return m_fp != nullptr; }
+            /// True if open() found an archive whose entries are kept,
+            /// false if it started a new one.
+            bool appending() const { return m_appending; }
+            const std::string& filename() const { return m_filename; }
+
+            /// Append an array as entry "<name>.npy".  The data is in
+            /// C order with the given (Numpy) shape.
+            template<typename T>
+            void write(const std::string& name, const T* data,
+                       const std::vector<size_t>& shape) {
+                const std::vector<char> header = cnpy::create_npy_header<T>(shape);
+                submit(name, header, reinterpret_cast<const char*>(data), nbytes<T>(shape));
+            }
+
+            /// An entry with its CRC found and its bytes compressed,
+            /// ready to be appended to an archive.
+            struct Prepared {
+                std::string name;           // without ".npy"
+                std::vector<char> header;   // of the .npy data
+                std::vector<char> stored;   // bytes to store in the file
+                // If stored, the array data following the bytes above
+                // when they are only the header.  Kept, not copied.
+                std::shared_ptr<const void> data;
+                size_t size{0};             // bytes of the .npy data
+                uint32_t crc{0};
+                int method{0};              // zip method, 0 stored or 8 deflated
+                double compress_s{0};       // seconds deflating
+            };
+
+            /// Make an entry as write() would but at the given level
+            /// (0 to store, 1-9 to deflate).  This needs no writer and
+            /// may be called from any thread.
+            template<typename T>
+            static Prepared prepare(const std::string& name, const T* data,
+                                    const std::vector<size_t>& shape, int level) {
+                const std::vector<char> header = cnpy::create_npy_header<T>(shape);
+                return prepare_bytes(name, header, reinterpret_cast<const char*>(data),
+                                     nbytes<T>(shape), level, true);
+            }
+
+            /// As above but if stored the entry keeps the array
+            /// instead of copying it.  The array must not change
+            /// until the entry is written.
+            template<typename T>
+            static Prepared prepare(const std::string& name, std::shared_ptr<const T> data,
+                                    const std::vector<size_t>& shape, int level) {
+                const std::vector<char> header = cnpy::create_npy_header<T>(shape);
+                Prepared entry = prepare_bytes(name, header, reinterpret_cast<const char*>(data.get()),
+                                               nbytes<T>(shape), level, false);
+                if (!entry.method) {
+                    entry.data = data;
+                }
+                return entry;
+            }
+
+            /// Append a prepared entry.  It is stored as it was
+            /// prepared, whatever the level given to open().
+            void write(Prepared entry);
+
+        private:
+
+            template<typename T>
+            static size_t nbytes(const std::vector<size_t>& shape) {
+                size_t nels = 1;
+                for (auto n : shape) { nels *= n; }
+                return nels*sizeof(T);
+            }
+            // Unless copy, a stored entry gets only the header.
+            static Prepared prepare_bytes(const std::string& name, const std::vector<char>& header,
+                                          const char* data, size_t size, int level, bool copy);
+
+            // A queued entry.  Unless ready, "stored" holds the array
+            // data still to be compressed by the I/O thread.
+            struct Entry {
+                Prepared prepared;
+                bool ready;
+            };
+
+            void submit(const std::string& name, const std::vector<char>& header,
+                        const char* data, size_t size);
+            void enqueue(Entry entry);
+            void append_prepared(const Prepared& entry);
+            void write_entry(const std::string& name, const std::vector<char>& header,
+                             const char* data, size_t size);
+            // Append an entry of nbytes with the given CRC, stored as
+            // the bytes of one or two pieces.
+            void append_entry(const std::string& name, const std::vector<char>& header,
+                              uint32_t crc, int method, size_t nbytes,
+                              const char* piece1, size_t size1,
+                              const char* piece2, size_t size2, double compress_s);
+            void read_directory(long fsize);
+
+            // async
+            void drain();       // I/O thread main
+            void wait_idle();   // return when queue is empty
+            void rethrow();     // any error from I/O thread
+
+            std::string m_filename;
+            FILE* m_fp;
+            std::vector<char> m_directory; // central directory records
+            size_t m_nrecs;                // number of records in directory
+            size_t m_offset;               // end of entries, start of directory
+            bool m_dirty;                  // entries written since last flush
+            bool m_appending;              // opened an existing archive
+            int m_level;                   // deflate level, 0 to store
+            std::vector<char> m_deflated;  // compression buffer
+
+            size_t m_depth;
+            std::thread m_thread;
+            std::mutex m_mutex;
+            std::condition_variable m_cond;
+            std::deque<Entry> m_queue;
+            bool m_busy, m_stop;
+            std::exception_ptr m_error;
+            Stats m_stats;      // guarded by m_mutex
+            size_t m_size;      // m_offset, guarded by m_mutex
+            std::vector<EntryInfo> m_written; // guarded by m_mutex
+        };
+    }
+}
+#endif
@@ -1,17 +1,55 @@
-/** Save depos to a Numpy file. */
+/** Save depos to a Numpy file.
+
+    Each depo and each of its priors is one row in a pair of arrays,
+    depo_data_N (float32: time, charge, x, y, z, dlong, dtran) and
+    depo_info_N (int32: ID, pdg, gen, child, prior), where N counts
+    EOS.  In Numpy the arrays have shape (7, nrows) and (5, nrows).
+    The "gen" is 0 for a depo as received and counts up its chain of
+    priors.  Each depo is saved once, also when it is shared as a
+    prior or is both received and the prior of another received
+    depo, so the rows form a DAG.  The "prior" is one plus the row of
+    this row's prior, or 0 if none.  The "child" is one plus the row
+    of the first depo found to have this row as its prior, or 0 if
+    none.
+
+    If "chunk_size" is set, rows are instead written as they arrive
+    in blocks of at most that many rows named depo_data_N_chunkK and
+    depo_info_N_chunkK.  Rows in "child" then count over all chunks
+    of save N.  A row already written is not amended: a received
+    depo keeps a "child" of 0 if its first child arrives in a later
+    chunk, and a depo received after its row was written as a prior
+    keeps its "gen".
+
+    Output may be split over several files named by save count or
+    part number (see Rollover).  The file is closed at each EOS and,
+    until it rolls over, reopened for appending by the next save.
+    With "index" set, an NpzIndex giving each save's depo and row
+    counts and arrays is written beside the file whenever it is
+    closed.
+ */
 
 #ifndef WIRECELLSIO_NUMPYDEPOSAVER
 #define WIRECELLSIO_NUMPYDEPOSAVER
 
 #include "WireCellIface/IDepoFilter.h"
 #include "WireCellIface/IConfigurable.h"
+#include "WireCellIface/ITerminal.h"
+#include "WireCellUtil/Logging.h"
+#include "WireCellSio/NpzWriter.h"
+#include "WireCellSio/Metrics.h"
+#include "WireCellSio/Rollover.h"
+#include "WireCellSio/NpzIndex.h"
+
+#include <unordered_map>
 
 namespace WireCell {
     namespace Sio {
 
-        // This saver will buffer depos in memory until EOS is received.
+        // This saver will buffer depos in memory until EOS is
+        // received unless configured to write in chunks.
         class NumpyDepoSaver : public WireCell::IDepoFilter,
-                               public WireCell::IConfigurable {
+                               public WireCell::IConfigurable,
+                               public WireCell::ITerminal {
         public:
             NumpyDepoSaver();
             virtual ~NumpyDepoSaver();
@@ -24,11 +62,45 @@ namespace WireCell {
             /// IConfigurable
             virtual WireCell::Configuration default_configuration() const;
             virtual void configure(const WireCell::Configuration& config);
+
+            /// ITerminal, close the file and report total metrics.
+            virtual void finalize();
         private:
 
+            void push_depo(WireCell::IDepo::pointer depo);
+            void amend_row(size_t row, bool received, size_t childid);
+            void push_row(const WireCell::IDepo::pointer& depo,
+                          size_t gen, size_t childid, size_t priorid);
+            void reserve(size_t nrows);
+            void flush_rows();
+            void close_file();  // and write its index
+
             Configuration m_cfg;
             int m_save_count;   // count frames saved
             std::vector<WireCell::IDepo::pointer> m_depos;
+            NpzWriter m_npz;
+            int m_level;        // compression, see NpzWriter::open()
+            Rollover m_roll;
+            bool m_indexed;
+            NpzIndex m_index;
+            std::vector<std::string> m_entries; // written for this save
+
+            // Columnar row buffers, column-major with m_capacity rows.
+            std::vector<float> m_data;
+            std::vector<int> m_info;
+            size_t m_chunk_size;  // 0 means save all at EOS
+            size_t m_capacity;    // rows allocated in the buffers
+            size_t m_nrows;       // rows filled in the buffers
+            size_t m_nflushed;    // rows of this save already written
+            int m_chunk_count;    // chunks of this save written
+
+            // Depos and priors already saved in this save mapped to
+            // their row.
+            std::unordered_map<WireCell::IDepo::pointer, size_t> m_visited;
+
+            size_t m_ndepos;      // depos received since EOS
+            Metrics m_metrics;
+            Log::logptr_t l;
       };
 
     }
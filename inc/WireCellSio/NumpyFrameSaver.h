@@ -1,18 +1,61 @@
-/** Some frames to a Numpy file */
+/** Some frames to a Numpy file
+
+    For each frame tag and save count N, the dense samples are saved
+    as frame_<tag>_N with shape (nticks, nchannels) along with the
+    channels_<tag>_N and tickinfo_<tag>_N = (time, tick, tbin0).
+
+    In "sparse" mode frame_<tag>_N is replaced by the runs of ticks
+    on a channel where some trace has a nonzero sample:
+
+    - samples_<tag>_N :: samples of all runs, concatenated
+    - trace_channels_<tag>_N :: channel of each run
+    - trace_tbins_<tag>_N :: first tbin of each run
+    - trace_offsets_<tag>_N :: index of each run's first sample and,
+      last, the total number of samples
+
+    and tickinfo_<tag>_N adds the number of ticks of the dense frame
+    and the value it has outside of any run.
+
+    Only traces on the configured "channels" and overlapping the
+    "tick_window" are used.  Samples outside the window are dropped.
+
+    Samples are saved as float32, int16 or uint16 per "dtype" or, for
+    "uint12", as a uint8 array holding pairs of 12 bit samples packed
+    in 3 bytes, the first in the low bits.  The packed dense frame has
+    shape (nticks, 3*ceil(nchannels/2)), each tick padded to a whole
+    pair, and packed sparse samples are padded likewise at the end.
+
+    Each frame is one save.  Output may be split over several files
+    named by save count, frame ident or part number (see Rollover).
+    Each file is a complete archive once closed.  With "index" set,
+    an NpzIndex of the file giving each frame's ident, time, tick,
+    tags and arrays is written beside it whenever it is closed.
+ */
 
 #ifndef WIRECELLSIO_NUMPYFRAMESAVER
 #define WIRECELLSIO_NUMPYFRAMESAVER
 
 #include "WireCellIface/IFrameFilter.h"
 #include "WireCellIface/IConfigurable.h"
+#include "WireCellIface/ITerminal.h"
 #include "WireCellUtil/Logging.h"
+#include "WireCellSio/NpzWriter.h"
+#include "WireCellSio/Metrics.h"
+#include "WireCellSio/NpzIndex.h"
+#include "WireCellSio/Rollover.h"
+
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace WireCell {
     namespace Sio {
 
-        // This saver immediately saves each frame.
+        // This saver immediately saves each frame.  The output file
+        // is held open from configure() until EOS.
         class NumpyFrameSaver : public virtual WireCell::IFrameFilter,
-                           public WireCell::IConfigurable {
+                           public WireCell::IConfigurable,
+                           public WireCell::ITerminal {
         public:
             NumpyFrameSaver();
             virtual ~NumpyFrameSaver();
@@ -24,10 +67,26 @@ namespace WireCell {
             /// IConfigurable
             virtual WireCell::Configuration default_configuration() const;
             virtual void configure(const WireCell::Configuration& config);
+
+            /// ITerminal, close the file and report total metrics.
+            virtual void finalize();
         private:
 
+            void close_file();  // and write its index
+
             Configuration m_cfg;
             int m_save_count;   // count frames saved
+            NpzWriter m_npz;
+            int m_level;        // compression, see NpzWriter::open()
+            Rollover m_roll;
+            bool m_indexed;
+            NpzIndex m_index;
+            std::string m_dtype;
+            // channels and ticks to save, see configuration
+            std::vector< std::pair<int,int> > m_channels;
+            bool m_windowed;
+            std::pair<int,int> m_tick_window;
+            Metrics m_metrics;
             Log::logptr_t l;
         };
     }
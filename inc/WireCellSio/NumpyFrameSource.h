@@ -0,0 +1,81 @@
+/** Replay frames from a Numpy .npz file written by NumpyFrameSaver.
+
+    For each save count N found, the frame_<tag>_N, channels_<tag>_N
+    and tickinfo_<tag>_N arrays of every tag are read, one entry at a
+    time, directly from the memory-mapped file (or inflated if
+    compressed).  One IFrame is emitted per N, in order of N, followed
+    by EOS.  Each row of a frame array becomes one trace and traces
+    are tagged with the tag they were saved under.  The frame ident
+    is as saved if the file has an NpzIndex, else N.  Its time and
+    tick are taken from tickinfo.
+
+    Tags saved in sparse mode (samples_<tag>_N and its runs) give one
+    trace per run or, if "dense" is set, are rebuilt into one trace
+    per channel as for a dense save.
+
+    Samples may be float32, int16, uint16 or packed uint12.  They are
+    read as saved.  Any baseline, scale or offset applied
+    by the saver is not undone.
+
+    Frame and trace counts, decode time and rates are reported at EOS
+    and at finalize (see Metrics).
+ */
+
+#ifndef WIRECELLSIO_NUMPYFRAMESOURCE
+#define WIRECELLSIO_NUMPYFRAMESOURCE
+
+#include "WireCellIface/IFrameSource.h"
+#include "WireCellIface/IConfigurable.h"
+#include "WireCellIface/ITerminal.h"
+#include "WireCellUtil/Logging.h"
+#include "WireCellSio/Metrics.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace WireCell {
+    namespace Sio {
+
+        class NpzReader;
+        class NumpyFrameSource : public WireCell::IFrameSource,
+                                 public WireCell::IConfigurable,
+                                 public WireCell::ITerminal {
+        public:
+            NumpyFrameSource();
+            virtual ~NumpyFrameSource();
+
+            /// IFrameSource
+            virtual bool operator()(IFrame::pointer& out);
+
+            /// IConfigurable
+            virtual WireCell::Configuration default_configuration() const;
+            virtual void configure(const WireCell::Configuration& config);
+
+            /// ITerminal, report total metrics.
+            virtual void finalize();
+
+        private:
+
+            IFrame::pointer load(int save);
+            void load_dense(const std::string& name, const std::string& tag, int save,
+                            const std::vector<double>& tickinfo,
+                            ITrace::vector& all_traces, IFrame::trace_list_t& indices);
+            void load_sparse(const std::string& tag, int save,
+                             const std::vector<double>& tickinfo,
+                             ITrace::vector& all_traces, IFrame::trace_list_t& indices);
+
+            std::unique_ptr<NpzReader> m_reader;
+            // save number to tags saved with it, in archive order
+            std::map<int, std::vector<std::string> > m_saves;
+            // save number to frame ident, from any index
+            std::map<int, int> m_idents;
+            bool m_dense;
+            bool m_eos;
+            Metrics m_metrics;
+            Log::logptr_t l;
+        };
+    }
+}
+#endif
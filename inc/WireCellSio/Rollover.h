@@ -0,0 +1,67 @@
+/** Name the output files of a saver and decide when to start a new one.
+
+    The "filename" may hold these placeholders:
+
+    - {count} :: the save count of the first save in the file
+    - {ident} :: the frame ident of the first save in the file, or
+                 the save count if the saver has no frame
+    - {part} :: counts files from zero
+
+    A file is named when its first save is written.  It rolls over,
+    and the next save starts a new file, once it holds "max_saves"
+    saves or "max_bytes" bytes of entries.  Zero means no limit, but
+    a filename with {count} or {ident} and no limit gets one save per
+    file.  Rollover needs a placeholder in the filename so that each
+    file has its own name.
+ */
+
+#ifndef WIRECELLSIO_ROLLOVER
+#define WIRECELLSIO_ROLLOVER
+
+#include "WireCellUtil/Configuration.h"
+
+#include <string>
+
+namespace WireCell {
+    namespace Sio {
+
+        class Rollover {
+        public:
+            Rollover();
+
+            /// Read "filename", "max_saves" and "max_bytes".  Throws
+            /// ValueError if either limit is negative or if rollover
+            /// is asked for without a placeholder in the filename.
+            void configure(const Configuration& cfg);
+
+            /// True if the filename has no placeholder.  The saver
+            /// then always writes the one file.
+            bool fixed() const { return m_fixed; }
+
+            /// Return the name of the current file, naming it from
+            /// this first save if it is new.
+            std::string filename(int count, int ident);
+
+            /// True if files are limited in bytes.  Only then does
+            /// saved() need the file size.
+            bool max_bytes() const { return m_max_bytes != 0; }
+
+            /// Note a save was written to the current file, now of
+            /// "size" bytes.  Return true if the file is full.  The
+            /// caller should then close it and call next().
+            bool saved(size_t size);
+
+            /// Start a new file for the next save.
+            void next();
+
+        private:
+            std::string m_template, m_current;
+            bool m_fixed;
+            int m_max_saves;
+            size_t m_max_bytes;
+            int m_part;
+            int m_nsaves;       // in current file
+        };
+    }
+}
+#endif
@@ -0,0 +1,70 @@
+#include "WireCellSio/BeeDepoSetSource.h"
+
+#include "WireCellIface/SimpleDepoSet.h"
+#include "WireCellUtil/NamedFactory.h"
+
+WIRECELL_FACTORY(BeeDepoSetSource, WireCell::Sio::BeeDepoSetSource,
+                 WireCell::IDepoSetSource, WireCell::IConfigurable, WireCell::ITerminal)
+
+#include <algorithm>
+
+using namespace WireCell;
+
+Sio::BeeDepoSetSource::BeeDepoSetSource()
+    : m_block_size(0)
+    , m_next(0)
+    , m_count(0)
+    , m_eos(false)
+{
+}
+
+Sio::BeeDepoSetSource::~BeeDepoSetSource()
+{
+}
+
+bool Sio::BeeDepoSetSource::operator()(IDepoSet::pointer& out)
+{
+    out = nullptr;
+    if (m_eos) {
+        return false;
+    }
+
+    if (m_next >= m_depos.size()) {
+        m_next = 0;
+        if (!m_source.batch(m_depos)) {
+            m_eos = true;
+            return true;        // EOS
+        }
+    }
+
+    size_t ndepos = m_depos.size() - m_next;
+    if (m_block_size) {
+        ndepos = std::min(ndepos, m_block_size);
+    }
+    auto beg = m_depos.begin() + m_next;
+    out = std::make_shared<SimpleDepoSet>(m_count++, IDepo::vector(beg, beg + ndepos));
+    m_next += ndepos;
+    return true;
+}
+
+WireCell::Configuration Sio::BeeDepoSetSource::default_configuration() const
+{
+    Configuration cfg = m_source.default_configuration();
+    cfg["block_size"] = 0; // max depos per set, 0 for a set per file.
+    return cfg;
+}
+
+void Sio::BeeDepoSetSource::configure(const WireCell::Configuration& cfg)
+{
+    m_source.configure(cfg);
+    m_block_size = get(cfg, "block_size", 0);
+    m_depos.clear();
+    m_next = 0;
+    m_count = 0;
+    m_eos = false;
+}
+
+void Sio::BeeDepoSetSource::finalize()
+{
+    m_source.finalize();
+}
@@ -1,4 +1,5 @@
 #include "WireCellSio/BeeDepoSource.h"
+#include "WireCellSio/DepoArena.h"
 
 #include "WireCellIface/IRecombinationModel.h"
 
@@ -7,11 +8,15 @@
 
 #include "WireCellUtil/Point.h"
 #include "WireCellUtil/Persist.h"
+#include "WireCellUtil/Exceptions.h"
 
 WIRECELL_FACTORY(BeeDepoSource, WireCell::Sio::BeeDepoSource,
-                 WireCell::IDepoSource, WireCell::IConfigurable)
+                 WireCell::IDepoSource, WireCell::IConfigurable, WireCell::ITerminal)
 
+#include <algorithm>
 #include <iostream>
+#include <map>
+#include <numeric>
 #include <string>
 #include <locale>               // for std::tolower
 
@@ -20,57 +25,326 @@ using namespace WireCell;
 
 Sio::BeeDepoSource::BeeDepoSource()
     : m_policy("")
+    , m_readahead(0)
+    , m_arena(false)
+    , m_sorted(false)
+    , m_merge(1)
+    , m_in_group(false)
+    , m_workers(0)
+    , m_nsharded(0)
+    , m_ntaken(0)
+    , m_shard_stop(false)
+    , m_metrics("BeeDepoSource")
 {
+    m_metrics.rate("depos_per_s", "depos", "span_s");
 }
 
 Sio::BeeDepoSource::~BeeDepoSource()
 {
+    stop_shards();
 }
 
-bool Sio::BeeDepoSource::operator()(IDepo::pointer& out)
+// Depos per DepoArena block.  Blocks are filled in the order depos
+// are emitted so each is freed soon after its last depo is consumed.
+static const size_t arena_block = 16384;
+
+// The depo attributes taken from columns of a file.
+static const size_t ncolumns = 5;
+static const char* const column_keys[ncolumns] = {"t", "x", "y", "z", "q"};
+
+// Decode one file into its depos in file order or, if sorted, in
+// time order with ties kept in file order.  Each column is found
+// once and converted in one pass.  A missing column takes its value
+// from defaults.
+static IDepo::vector load_depos(const std::string& fname, bool arena, bool sorted,
+                                const std::map<std::string, double>& defaults)
 {
-    out = nullptr;
+    const Json::Value jdat = Persist::load(fname);
 
-    if (m_depos.size() > 0) {
-        out = m_depos.back();
-        m_depos.pop_back();
-        return true;
+    std::vector<double> cols[ncolumns];
+    bool present[ncolumns] = {false};
+    size_t ndepos = 0;
+    for (size_t icol=0; icol<ncolumns; ++icol) {
+        const std::string key = column_keys[icol];
+        if (!jdat.isMember(key)) {
+            continue;
+        }
+        const Json::Value& jcol = jdat[key];
+        if (!jcol.isArray()) {
+            THROW(ValueError() << errmsg{"BeeDepoSource: \"" + key + "\" is not an array in " + fname});
+        }
+        if (jcol.size() != ndepos and std::any_of(present, present+icol, [](bool p) { return p; })) {
+            THROW(ValueError() << errmsg{"BeeDepoSource: columns differ in length in " + fname});
+        }
+        ndepos = jcol.size();
+        present[icol] = true;
+        auto& col = cols[icol];
+        col.reserve(ndepos);
+        for (const auto& jval : jcol) {
+            col.push_back(jval.asDouble());
+        }
+    }
+    if (!ndepos) {
+        return IDepo::vector();
+    }
+    for (size_t icol=0; icol<ncolumns; ++icol) {
+        if (present[icol]) {
+            continue;
+        }
+        auto it = defaults.find(column_keys[icol]);
+        if (it == defaults.end()) {
+            THROW(ValueError() << errmsg{"BeeDepoSource: no \"" + std::string(column_keys[icol])
+                        + "\" in " + fname + " and no default"});
+        }
+        cols[icol].assign(ndepos, it->second);
     }
+    const auto& t = cols[0];
+    const auto& x = cols[1];
+    const auto& y = cols[2];
+    const auto& z = cols[3];
+    const auto& q = cols[4];
 
-    // refill
-    while (!m_filenames.empty()) {
+    std::vector<size_t> order(ndepos);
+    std::iota(order.begin(), order.end(), 0);
+    if (sorted) {
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return t[a] < t[b];
+        });
+    }
+
+    IDepo::vector depos(ndepos, nullptr);
+    Sio::DepoArena slab(std::min(ndepos, arena_block));
+    for (size_t ind=0; ind < ndepos; ++ind) {
+        const size_t idepo = order[ind];
+        const Point pos(x[idepo], y[idepo], z[idepo]);
+        if (arena) {
+            depos[ind] = slab.make(t[idepo], pos, q[idepo]);
+        }
+        else {
+            depos[ind] = std::make_shared<SimpleDepo>(t[idepo], pos, q[idepo]);
+        }
+    }
+    return depos;
+}
+
+void Sio::BeeDepoSource::start_shards()
+{
+    std::vector<std::string> filenames(m_filenames.rbegin(), m_filenames.rend());
+    m_filenames.clear();
+    const size_t nshards = std::min(m_workers, filenames.size());
+    for (size_t ind=0; ind<nshards; ++ind) {
+        m_shards.emplace_back(new Shard);
+    }
+    for (size_t ind=0; ind<filenames.size(); ++ind) {
+        m_shards[ind % nshards]->filenames.push_back(filenames[ind]);
+    }
+    m_nsharded = filenames.size();
+    m_ntaken = 0;
+    m_shard_stop = false;
+    for (auto& shard : m_shards) {
+        shard->thread = std::thread(&Sio::BeeDepoSource::run_shard, this, std::ref(*shard));
+    }
+}
+
+void Sio::BeeDepoSource::stop_shards()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_shard_mutex);
+        m_shard_stop = true;
+    }
+    m_shard_cond.notify_all();
+    for (auto& shard : m_shards) {
+        shard->thread.join();
+    }
+    m_shards.clear();
+    m_nsharded = m_ntaken = 0;
+}
+
+void Sio::BeeDepoSource::run_shard(Shard& shard)
+{
+    const size_t depth = std::max<size_t>(1, m_readahead);
+    for (const auto& fname : shard.filenames) {
+        {
+            std::unique_lock<std::mutex> lock(m_shard_mutex);
+            m_shard_cond.wait(lock, [&]{ return m_shard_stop or shard.done.size() < depth; });
+            if (m_shard_stop) {
+                return;
+            }
+        }
+        IDepo::vector depos;
+        try {
+            depos = load_depos(fname, m_arena, m_sorted, m_defaults);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(m_shard_mutex);
+            shard.error = std::current_exception();
+            m_shard_cond.notify_all();
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_shard_mutex);
+            shard.done.push_back(std::move(depos));
+        }
+        m_shard_cond.notify_all();
+    }
+}
+
+bool Sio::BeeDepoSource::more_files() const
+{
+    return !m_filenames.empty() or !m_pending.empty() or m_ntaken < m_nsharded;
+}
+
+IDepo::vector Sio::BeeDepoSource::next_file()
+{
+    if (m_workers) {
+        if (m_shards.empty()) {
+            start_shards();
+        }
+        // Take files back in list order.
+        Shard& shard = *m_shards[m_ntaken++ % m_shards.size()];
+        std::unique_lock<std::mutex> lock(m_shard_mutex);
+        m_shard_cond.wait(lock, [&]{ return !shard.done.empty() or shard.error; });
+        if (shard.done.empty()) {
+            std::rethrow_exception(shard.error);
+        }
+        IDepo::vector depos = std::move(shard.done.front());
+        shard.done.pop_front();
+        lock.unlock();
+        m_shard_cond.notify_all();
+        return depos;
+    }
 
+    if (!m_readahead) {
         std::string fname = m_filenames.back();
         m_filenames.pop_back();
-        Json::Value jdat = Persist::load(fname);
-        int ndepos = jdat["x"].size();
+        return load_depos(fname, m_arena, m_sorted, m_defaults);
+    }
+
+    // Keep up to m_readahead files decoding beyond the one returned.
+    while (m_pending.size() <= m_readahead and !m_filenames.empty()) {
+        m_pending.push_back(std::async(std::launch::async, load_depos,
+                                       m_filenames.back(), m_arena, m_sorted, m_defaults));
+        m_filenames.pop_back();
+    }
+    auto fut = std::move(m_pending.front());
+    m_pending.pop_front();
+    return fut.get();
+}
+
+// Input "a" comes after "b" if its next depo is later or, at equal
+// times, if it is a later input.
+bool Sio::BeeDepoSource::later(size_t a, size_t b) const
+{
+    const double ta = m_group[a][m_heads[a]]->time();
+    const double tb = m_group[b][m_heads[b]]->time();
+    if (ta == tb) {
+        return a > b;
+    }
+    return ta > tb;
+}
+
+bool Sio::BeeDepoSource::next_group()
+{
+    m_group.clear();
+    m_heads.clear();
+    m_heap.clear();
+    while (more_files()) {
+        size_t ndepos = 0;
+        while (m_group.size() < m_merge and more_files()) {
+            m_metrics.mark();
+            {
+                Metrics::Timer timer(m_metrics, "load_wait_s");
+                m_group.push_back(next_file());
+            }
+            m_metrics.add("files", 1);
+            ndepos += m_group.back().size();
+        }
         if (!ndepos) {
+            m_group.clear();
             continue;
         }
+        m_metrics.add("depos", ndepos);
+        m_metrics.peak("peak_buffered_depos", ndepos);
+        m_heads.assign(m_group.size(), 0);
+        for (size_t ind=0; ind<m_group.size(); ++ind) {
+            if (!m_group[ind].empty()) {
+                m_heap.push_back(ind);
+            }
+        }
+        auto cmp = [this](size_t a, size_t b) { return later(a, b); };
+        std::make_heap(m_heap.begin(), m_heap.end(), cmp);
+        return true;
+    }
+    return false;
+}
 
-        m_depos.resize(ndepos, nullptr);
-        for (int idepo=0; idepo < ndepos; ++idepo) {
-            m_depos[idepo] = std::make_shared<SimpleDepo>(
-                jdat["t"][idepo].asDouble(),
-                Point(
-                    jdat["x"][idepo].asDouble(),
-                    jdat["y"][idepo].asDouble(),
-                    jdat["z"][idepo].asDouble()),
-                jdat["q"][idepo].asDouble());
+IDepo::pointer Sio::BeeDepoSource::pop_group()
+{
+    if (m_heap.empty()) {
+        return nullptr;
+    }
+    if (m_heap.size() == 1) {   // one input left, no merging
+        const size_t ind = m_heap[0];
+        auto depo = std::move(m_group[ind][m_heads[ind]++]);
+        if (m_heads[ind] == m_group[ind].size()) {
+            m_heap.clear();
         }
+        return depo;
+    }
+    auto cmp = [this](size_t a, size_t b) { return later(a, b); };
+    std::pop_heap(m_heap.begin(), m_heap.end(), cmp);
+    const size_t ind = m_heap.back();
+    auto depo = std::move(m_group[ind][m_heads[ind]++]); // released once consumed
+    if (m_heads[ind] == m_group[ind].size()) {
+        m_heap.pop_back();
+    }
+    else {
+        std::push_heap(m_heap.begin(), m_heap.end(), cmp);
+    }
+    return depo;
+}
+
+bool Sio::BeeDepoSource::batch(IDepo::vector& depos)
+{
+    depos.clear();
+    if (!next_group()) {
+        m_metrics.eos();
+        return false;
+    }
+    if (m_group.size() == 1) {
+        depos.swap(m_group[0]);
+        m_heap.clear();
+        return true;
+    }
+    while (auto depo = pop_group()) {
+        depos.push_back(depo);
+    }
+    return true;
+}
+
+bool Sio::BeeDepoSource::operator()(IDepo::pointer& out)
+{
+    out = pop_group();
+    if (out) {
+        return true;
+    }
+
+    // The group is done.
+    if (m_in_group) {
+        m_in_group = false;
         if (m_policy != "stream") {
-            m_depos.push_back(nullptr); // chunk by file
+            m_metrics.eos();
+            return true;        // EOS
         }
-        std::reverse(m_depos.begin(), m_depos.end());
-        break;
     }
 
-    if (m_depos.empty()) {
+    // refill
+    if (!next_group()) {
+        m_metrics.eos();
         return false;
     }
-    
-    out = m_depos.back();
-    m_depos.pop_back();
+    m_in_group = true;
+    out = pop_group();
     return true;
 }
 
@@ -78,16 +352,60 @@ WireCell::Configuration Sio::BeeDepoSource::default_configuration() const
 {
     Configuration cfg;
     cfg["filelist"] = Json::arrayValue; // list of input files, empties are skipped
-    cfg["policy"] = ""; // set to "stream" to avoid sending EOS after each file's worth of depos.
+    cfg["policy"] = ""; // set to "stream" to avoid sending EOS after each file's (or group's) worth of depos.
+    cfg["readahead"] = 0; // number of following files to decode in background threads.
+    cfg["arena"] = false; // allocate each file's depos together, see DepoArena.
+    cfg["sort"] = false; // emit each file's depos in time order.
+    cfg["merge"] = 1; // merge this many consecutive files into one time ordered stream.
+    cfg["workers"] = 0; // number of reader threads sharing the files, 0 to decode in this one.
+    // values of depo attributes missing from a file, "t" is not in the usual Bee schema.
+    // Any of "x", "y", "z" or "q" missing with no default here is an error.
+    cfg["defaults"]["t"] = 0.0;
     return cfg;
 }
     
 
 void Sio::BeeDepoSource::configure(const WireCell::Configuration& cfg)
 {
+    stop_shards();
+    const int readahead = get(cfg, "readahead", 0);
+    const int workers = get(cfg, "workers", 0);
+    const int merge = get(cfg, "merge", 1);
+    if (readahead < 0) {
+        THROW(ValueError() << errmsg{"BeeDepoSource: readahead must not be negative"});
+    }
+    if (workers < 0) {
+        THROW(ValueError() << errmsg{"BeeDepoSource: workers must not be negative"});
+    }
+    if (merge < 1) {
+        THROW(ValueError() << errmsg{"BeeDepoSource: merge must be at least 1"});
+    }
     m_filenames = get< std::vector<std::string> >(cfg, "filelist");
     std::reverse(m_filenames.begin(), m_filenames.end()); // to use pop_back().
     m_policy = get<std::string>(cfg, "policy", "");
+    m_readahead = readahead;
+    m_arena = get(cfg, "arena", false);
+    m_merge = merge;
+    m_sorted = m_merge > 1 or get(cfg, "sort", false);
+    m_pending.clear();
+    m_group.clear();
+    m_heads.clear();
+    m_heap.clear();
+    m_in_group = false;
+    m_workers = workers;
+    m_defaults.clear();
+    auto jdefs = cfg["defaults"];
+    if (jdefs.isNull()) {
+        jdefs = default_configuration()["defaults"];
+    }
+    for (const auto& key : jdefs.getMemberNames()) {
+        m_defaults[key] = jdefs[key].asDouble();
+    }
 }
 
 
+
+void Sio::BeeDepoSource::finalize()
+{
+    m_metrics.finalize();
+}
@@ -0,0 +1,194 @@
+#include "WireCellSio/JsonArrayStream.h"
+
+#include "WireCellUtil/Exceptions.h"
+#include "WireCellUtil/String.h"
+
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filter/bzip2.hpp>
+#include <boost/iostreams/device/file.hpp>
+
+using namespace WireCell;
+
+static const int eof = std::char_traits<char>::eof();
+
+static bool endswith(const std::string& str, const std::string& ext)
+{
+    return str.size() >= ext.size()
+        and str.compare(str.size()-ext.size(), ext.size(), ext) == 0;
+}
+
+Sio::JsonArrayStream::JsonArrayStream(const std::string& filename, const std::string& dotpath)
+    : m_filename(filename)
+    , m_done(false)
+{
+    boost::iostreams::file_source source(filename, std::ios::binary);
+    if (!source.is_open()) {
+        THROW(IOError() << errmsg{"JsonArrayStream: failed to open " + filename});
+    }
+    auto fin = new boost::iostreams::filtering_istream;
+    m_in.reset(fin);
+    if (endswith(filename, ".gz")) {
+        fin->push(boost::iostreams::gzip_decompressor());
+    }
+    if (endswith(filename, ".bz2")) {
+        fin->push(boost::iostreams::bzip2_decompressor());
+    }
+    fin->push(source);
+
+    Json::CharReaderBuilder rbuilder;
+    m_reader.reset(rbuilder.newCharReader());
+
+    // Descend through the objects to the array.
+    for (const auto& key : String::split(dotpath, ".")) {
+        if (key.empty()) {
+            continue;
+        }
+        expect('{');
+        while (true) {
+            if (peek_nonws() == '}') {
+                THROW(IOError() << errmsg{"JsonArrayStream: no \"" + dotpath + "\" in " + filename});
+            }
+            const std::string got = read_key();
+            expect(':');
+            if (got == key) {
+                break;
+            }
+            read_value(nullptr);
+            if (peek_nonws() == ',') {
+                get();
+            }
+        }
+    }
+    expect('[');
+    if (peek_nonws() == ']') {
+        get();
+        m_done = true;
+    }
+}
+
+Sio::JsonArrayStream::~JsonArrayStream()
+{
+}
+
+int Sio::JsonArrayStream::get()
+{
+    return m_in->rdbuf()->sbumpc();
+}
+
+int Sio::JsonArrayStream::peek_nonws()
+{
+    auto sb = m_in->rdbuf();
+    while (true) {
+        const int ch = sb->sgetc();
+        if (ch == ' ' or ch == '\n' or ch == '\t' or ch == '\r') {
+            sb->sbumpc();
+            continue;
+        }
+        return ch;
+    }
+}
+
+void Sio::JsonArrayStream::expect(char want)
+{
+    const int ch = peek_nonws();
+    if (ch != want) {
+        std::string msg = "JsonArrayStream: expected '";
+        msg += want;
+        msg += "' in " + m_filename;
+        THROW(IOError() << errmsg{msg});
+    }
+    get();
+}
+
+std::string Sio::JsonArrayStream::read_key()
+{
+    if (peek_nonws() != '"') {
+        THROW(IOError() << errmsg{"JsonArrayStream: expected object key in " + m_filename});
+    }
+    std::string raw;
+    read_value(&raw);
+    return raw.substr(1, raw.size()-2); // keys are compared unescaped
+}
+
+void Sio::JsonArrayStream::read_value(std::string* out)
+{
+    auto put = [&](int ch) {
+        if (ch == eof) {
+            THROW(IOError() << errmsg{"JsonArrayStream: unexpected end of " + m_filename});
+        }
+        if (out) {
+            out->push_back(ch);
+        }
+    };
+    auto string_rest = [&]() {  // after the opening quote
+        while (true) {
+            const int ch = get();
+            put(ch);
+            if (ch == '\\') {
+                put(get());
+            }
+            else if (ch == '"') {
+                return;
+            }
+        }
+    };
+
+    int ch = peek_nonws();
+    if (ch == '"') {
+        put(get());
+        string_rest();
+        return;
+    }
+    if (ch == '{' or ch == '[') {
+        int depth = 0;
+        do {
+            ch = get();
+            put(ch);
+            if (ch == '"') {
+                string_rest();
+            }
+            else if (ch == '{' or ch == '[') {
+                ++depth;
+            }
+            else if (ch == '}' or ch == ']') {
+                --depth;
+            }
+        } while (depth > 0);
+        return;
+    }
+    // number, true, false or null
+    auto sb = m_in->rdbuf();
+    while (true) {
+        ch = sb->sgetc();
+        if (ch == eof or ch == ',' or ch == '}' or ch == ']'
+            or ch == ' ' or ch == '\n' or ch == '\t' or ch == '\r') {
+            return;
+        }
+        put(sb->sbumpc());
+    }
+}
+
+bool Sio::JsonArrayStream::next(Json::Value& element)
+{
+    if (m_done) {
+        return false;
+    }
+    m_text.clear();
+    read_value(&m_text);
+
+    const int ch = peek_nonws();
+    get();
+    if (ch == ']') {
+        m_done = true;
+    }
+    else if (ch != ',') {
+        THROW(IOError() << errmsg{"JsonArrayStream: malformed array in " + m_filename});
+    }
+
+    std::string errs;
+    if (!m_reader->parse(m_text.data(), m_text.data() + m_text.size(), &element, &errs)) {
+        THROW(IOError() << errmsg{"JsonArrayStream: " + errs + " in " + m_filename});
+    }
+    return true;
+}
@@ -0,0 +1,56 @@
+#include "WireCellSio/JsonDepoSetSource.h"
+
+#include "WireCellIface/SimpleDepoSet.h"
+#include "WireCellUtil/NamedFactory.h"
+
+WIRECELL_FACTORY(JsonDepoSetSource, WireCell::Sio::JsonDepoSetSource,
+                 WireCell::IDepoSetSource, WireCell::IConfigurable, WireCell::ITerminal)
+
+using namespace WireCell;
+
+Sio::JsonDepoSetSource::JsonDepoSetSource()
+    : m_block_size(0)
+    , m_count(0)
+    , m_eos(false)
+{
+}
+
+Sio::JsonDepoSetSource::~JsonDepoSetSource()
+{
+}
+
+bool Sio::JsonDepoSetSource::operator()(IDepoSet::pointer& out)
+{
+    out = nullptr;
+    if (m_eos) {
+        return false;
+    }
+
+    IDepo::vector depos;
+    if (!m_source.batch(depos, m_block_size)) {
+        m_eos = true;
+        return true;            // EOS
+    }
+    out = std::make_shared<SimpleDepoSet>(m_count++, depos);
+    return true;
+}
+
+WireCell::Configuration Sio::JsonDepoSetSource::default_configuration() const
+{
+    Configuration cfg = m_source.default_configuration();
+    cfg["block_size"] = 0; // max depos per set, 0 for a single set.
+    return cfg;
+}
+
+void Sio::JsonDepoSetSource::configure(const WireCell::Configuration& cfg)
+{
+    m_source.configure(cfg);
+    m_block_size = get(cfg, "block_size", 0);
+    m_count = 0;
+    m_eos = false;
+}
+
+void Sio::JsonDepoSetSource::finalize()
+{
+    m_source.finalize();
+}
@@ -1,4 +1,6 @@
 #include "WireCellSio/JsonDepoSource.h"
+#include "WireCellSio/DepoArena.h"
+#include "WireCellSio/JsonArrayStream.h"
 
 #include "WireCellIface/IRecombinationModel.h"
 
@@ -7,11 +9,13 @@
 
 #include "WireCellUtil/Point.h"
 #include "WireCellUtil/Persist.h"
+#include "WireCellUtil/Exceptions.h"
 
 WIRECELL_FACTORY(JsonDepoSource, WireCell::Sio::JsonDepoSource,
-                 WireCell::IDepoSource, WireCell::IConfigurable)
+                 WireCell::IDepoSource, WireCell::IConfigurable, WireCell::ITerminal)
 
-#include <iostream>
+#include <algorithm>
+#include <cmath>
 #include <string>
 #include <locale>               // for std::tolower
 
@@ -24,55 +28,276 @@ using namespace WireCell;
 // two cases a real RecombinationModel is used to return amount of
 // drifting charge for given point energy deposition "q" or as both
 // q=dE and s=dX.
+//
+// An adapter converts a batch of depos at once from columns of the
+// depo attributes it names, so there is one virtual call per batch.
 class Sio::JsonRecombinationAdaptor {
 public:
     virtual ~JsonRecombinationAdaptor() {}
-    virtual double operator()(Json::Value depo) const = 0;
+    // Names of the depo attributes to give as columns.
+    virtual std::vector<std::string> keys() const = 0;
+    // Set n charges from columns in the order of keys().
+    virtual void operator()(size_t n, const double* const* cols, double* charge) const = 0;
 };
-class ElectronsAdapter : public Sio::JsonRecombinationAdaptor {
-    double m_scale;
-public:
-    ElectronsAdapter(double scale=1.0) : m_scale(scale) {}
-    virtual ~ElectronsAdapter() {};
-    virtual double operator()(Json::Value depo) const {
-        return m_scale*depo["n"].asInt()*(-1.0*units::eplus);
+
+// The per-depo conversions.  These are inlined into the batch loop
+// of ColumnAdapter, which for electrons is then vectorizable.  The
+// models have no batch interface and stay one virtual call per depo.
+struct ElectronsCharge {
+    double scale;
+    double operator()(double n) const {
+        return scale*std::trunc(n)*(-1.0*units::eplus);
+    }
+};
+struct PointCharge {
+    IRecombinationModel::pointer model;
+    double operator()(double dE) const {
+        return (*model)(dE);
+    }
+};
+struct StepCharge {
+    IRecombinationModel::pointer model;
+    double operator()(double dE, double dX) const {
+        return (*model)(dE, dX);
     }
 };
-class PointAdapter : public Sio::JsonRecombinationAdaptor {
-    IRecombinationModel::pointer m_model;
+
+template<typename Charge, int ncols> class ColumnAdapter;
+template<typename Charge>
+class ColumnAdapter<Charge, 1> : public Sio::JsonRecombinationAdaptor {
+    Charge m_charge;
+    std::string m_key;
 public:
-    PointAdapter(IRecombinationModel::pointer model) : m_model(model) {}
-    virtual ~PointAdapter() {}
-    virtual double operator()(Json::Value depo) const {
-        const double dE = depo["q"].asDouble();
-        return (*m_model)(dE);
+    ColumnAdapter(Charge charge, std::string key) : m_charge(charge), m_key(key) {}
+    virtual ~ColumnAdapter() {}
+    virtual std::vector<std::string> keys() const { return {m_key}; }
+    virtual void operator()(size_t n, const double* const* cols, double* charge) const {
+        const double* c0 = cols[0];
+        for (size_t ind=0; ind<n; ++ind) {
+            charge[ind] = m_charge(c0[ind]);
+        }
     }
 };
-class StepAdapter : public Sio::JsonRecombinationAdaptor {
-    IRecombinationModel::pointer m_model;
+template<typename Charge>
+class ColumnAdapter<Charge, 2> : public Sio::JsonRecombinationAdaptor {
+    Charge m_charge;
+    std::string m_key0, m_key1;
 public:
-    StepAdapter(IRecombinationModel::pointer model) : m_model(model) {}
-    virtual ~StepAdapter() {}
-    virtual double operator()(Json::Value depo) const {
-        const double dE = depo["q"].asDouble();
-        const double dX = depo["s"].asDouble();
-        return (*m_model)(dE, dX);
+    ColumnAdapter(Charge charge, std::string key0, std::string key1)
+        : m_charge(charge), m_key0(key0), m_key1(key1) {}
+    virtual ~ColumnAdapter() {}
+    virtual std::vector<std::string> keys() const { return {m_key0, m_key1}; }
+    virtual void operator()(size_t n, const double* const* cols, double* charge) const {
+        const double* c0 = cols[0];
+        const double* c1 = cols[1];
+        for (size_t ind=0; ind<n; ++ind) {
+            charge[ind] = m_charge(c0[ind], c1[ind]);
+        }
     }
 };
+typedef ColumnAdapter<ElectronsCharge, 1> ElectronsAdapter;
+typedef ColumnAdapter<PointCharge, 1> PointAdapter;
+typedef ColumnAdapter<StepCharge, 2> StepAdapter;
 
 
 using namespace std;
 using namespace WireCell;
 
+// Depos per DepoArena block when their number is not known up front.
+static const size_t arena_block = 16384;
+// Depos per call to the recombination adapter.
+static const size_t convert_batch = 4096;
+
 Sio::JsonDepoSource::JsonDepoSource()
-    : m_adapter(nullptr), m_eos(false)
+    : m_adapter(nullptr)
+    , m_stream(false)
+    , m_window_size(0)
+    , m_pos(0)
+    , m_loaded(false)
+    , m_eos(false)
+    , m_ndepos(0)
+    , m_metrics("JsonDepoSource")
+    , l(Log::logger("io"))
 {
+    m_metrics.rate("depos_per_s", "depos", "span_s");
+    m_metrics.rate("load_depos_per_s", "loaded", "load_s");
 }
 
 Sio::JsonDepoSource::~JsonDepoSource()
 {
+    clear();
+    delete m_adapter;
 }
 
+void Sio::JsonDepoSource::clear()
+{
+    for (auto& run : m_runs) {
+        fclose(run.fp);
+    }
+    m_runs.clear();
+    m_heap.clear();
+    m_window.clear();
+    m_window.shrink_to_fit();
+    m_pos = 0;
+    m_arena.reset();
+    m_loaded = false;
+    m_eos = false;
+}
+
+static bool record_before(double t1, double x1, double t2, double x2)
+{
+    if (t1 == t2) {
+        return x1 < x2;
+    }
+    return t1 < t2;
+}
+
+void Sio::JsonDepoSource::spill()
+{
+    FILE* fp = std::tmpfile();
+    if (!fp) {
+        THROW(IOError() << errmsg{"JsonDepoSource: failed to make temporary file"});
+    }
+    const size_t n = m_window.size();
+    if (fwrite(m_window.data(), sizeof(Record), n, fp) != n or fflush(fp) != 0) {
+        fclose(fp);
+        THROW(IOError() << errmsg{"JsonDepoSource: failed to write temporary file"});
+    }
+    rewind(fp);
+    m_runs.push_back(Run{fp, Record{}});
+    m_window.clear();
+}
+
+void Sio::JsonDepoSource::load()
+{
+    m_loaded = true;
+    if (m_filename.empty() or !m_adapter) {
+        return;
+    }
+    Metrics::Timer timer(m_metrics, "load_s");
+
+    auto by_time = [](const Record& a, const Record& b) {
+        return record_before(a.t, a.x, b.t, b.x);
+    };
+    size_t ndepos = 0;
+    double qtot = 0;
+
+    // Charges are found in batches from columns of the attributes
+    // the adapter needs.  Those of m_window from "first" are pending.
+    const auto keys = m_adapter->keys();
+    std::vector< std::vector<double> > cols(keys.size());
+    std::vector<const double*> colptrs(keys.size());
+    std::vector<double> charge;
+    size_t first = 0;
+    auto convert = [&]() {
+        const size_t n = m_window.size() - first;
+        for (size_t icol=0; icol<cols.size(); ++icol) {
+            colptrs[icol] = cols[icol].data();
+        }
+        charge.resize(n);
+        (*m_adapter)(n, colptrs.data(), charge.data());
+        for (size_t ind=0; ind<n; ++ind) {
+            m_window[first+ind].q = charge[ind];
+            qtot += charge[ind];
+        }
+        for (auto& col : cols) {
+            col.clear();
+        }
+        first = m_window.size();
+    };
+
+    auto add = [&](const Json::Value& jdepo) {
+        if (m_window_size and m_window.size() == m_window_size) {
+            convert();
+            std::sort(m_window.begin(), m_window.end(), by_time);
+            spill();
+            first = 0;
+        }
+        m_window.push_back(Record{get(jdepo, "t", 0.0),
+                                  get(jdepo, "x", 0.0),
+                                  get(jdepo, "y", 0.0),
+                                  get(jdepo, "z", 0.0), 0.0});
+        for (size_t icol=0; icol<keys.size(); ++icol) {
+            cols[icol].push_back(jdepo[keys[icol]].asDouble());
+        }
+        if (m_window.size() - first == convert_batch) {
+            convert();
+        }
+        ++ndepos;
+    };
+
+    if (m_window_size) {
+        m_window.reserve(m_window_size);
+    }
+    if (m_stream) {
+        // Parse one depo at a time, never holding the document tree.
+        JsonArrayStream jdepos(m_filename, m_dotpath);
+        Json::Value jdepo;
+        while (jdepos.next(jdepo)) {
+            add(jdepo);
+        }
+    }
+    else {
+        Json::Value top = WireCell::Persist::load(m_filename.c_str());
+        for (const auto& jdepo : branch(top, m_dotpath)) {
+            add(jdepo);
+        }
+    }
+    convert();
+    std::sort(m_window.begin(), m_window.end(), by_time);
+
+    // Prime the merge with the head of each spilled run.
+    for (size_t ind=0; ind<m_runs.size(); ++ind) {
+        if (fread(&m_runs[ind].head, sizeof(Record), 1, m_runs[ind].fp) == 1) {
+            m_heap.push_back(ind);
+        }
+    }
+    std::make_heap(m_heap.begin(), m_heap.end(), [&](size_t a, size_t b) {
+        return record_before(m_runs[b].head.t, m_runs[b].head.x,
+                             m_runs[a].head.t, m_runs[a].head.x);
+    });
+
+    m_metrics.add("loaded", ndepos);
+    m_metrics.add("runs", m_runs.size() + 1);
+    m_metrics.peak("peak_buffered_depos", m_window_size ? std::min(m_window_size, ndepos) : ndepos);
+
+    l->debug("JsonDepoSource: loaded {} depositions = {} electrons in {} sorted runs",
+             ndepos, -1*qtot/units::eplus, m_runs.size() + 1);
+}
+
+bool Sio::JsonDepoSource::next(Record& rec)
+{
+    if (!m_loaded) {
+        load();
+    }
+    auto later = [&](size_t a, size_t b) {
+        return record_before(m_runs[b].head.t, m_runs[b].head.x,
+                             m_runs[a].head.t, m_runs[a].head.x);
+    };
+
+    const bool have_mem = m_pos < m_window.size();
+    if (m_heap.empty() or (have_mem and
+                           !record_before(m_runs[m_heap.front()].head.t,
+                                          m_runs[m_heap.front()].head.x,
+                                          m_window[m_pos].t, m_window[m_pos].x))) {
+        if (!have_mem) {
+            return false;
+        }
+        rec = m_window[m_pos++];
+        return true;
+    }
+
+    std::pop_heap(m_heap.begin(), m_heap.end(), later);
+    auto& run = m_runs[m_heap.back()];
+    rec = run.head;
+    if (fread(&run.head, sizeof(Record), 1, run.fp) == 1) {
+        std::push_heap(m_heap.begin(), m_heap.end(), later);
+    }
+    else {
+        m_heap.pop_back();
+    }
+    return true;
+}
 
 bool Sio::JsonDepoSource::operator()(IDepo::pointer& out)
 {
@@ -80,17 +305,47 @@ bool Sio::JsonDepoSource::operator()(IDepo::pointer& out)
 	return false;
     }
 
-    if (m_depos.empty()) {
+    m_metrics.mark();
+    Record rec;
+    if (!next(rec)) {
 	m_eos = true;
 	out = nullptr;
+        m_metrics.add("depos", m_ndepos);
+        m_ndepos = 0;
+        m_metrics.eos();
 	return true;
     }
 
-    out = m_depos.back();
-    m_depos.pop_back();
+    out = make_depo(rec);
+    ++m_ndepos;
+    return true;
+}
+
+bool Sio::JsonDepoSource::batch(IDepo::vector& depos, size_t maxn)
+{
+    depos.clear();
+    m_metrics.mark();
+    Record rec;
+    while ((!maxn or depos.size() < maxn) and next(rec)) {
+        depos.push_back(make_depo(rec));
+    }
+    m_ndepos += depos.size();
+    if (depos.empty()) {
+        m_metrics.add("depos", m_ndepos);
+        m_ndepos = 0;
+        m_metrics.eos();
+        return false;
+    }
     return true;
 }
 
+void Sio::JsonDepoSource::finalize()
+{
+    m_metrics.add("depos", m_ndepos);
+    m_ndepos = 0;
+    m_metrics.finalize();
+}
+
 WireCell::Configuration Sio::JsonDepoSource::default_configuration() const
 {
     Configuration cfg;
@@ -99,26 +354,51 @@ WireCell::Configuration Sio::JsonDepoSource::default_configuration() const
     cfg["model"] = "electrons"; // model for converting "q" and maybe
                                 // "s" or "n" to amount of drifting
                                 // charge.
+    cfg["arena"] = false;       // allocate depos together, see DepoArena.
+    cfg["stream"] = false;      // parse one depo at a time, see
+                                // JsonArrayStream.  Not for Jsonnet.
+    cfg["window"] = 0;          // max depos sorted in memory, 0 for all.
+                                // Each extra run holds a temporary file.
     return cfg;
 }
 
+Sio::JsonDepoSource::Record Sio::JsonDepoSource::jdepo2record(Json::Value jdepo)
+{
+    Record rec{get(jdepo, "t", 0.0),
+               get(jdepo, "x", 0.0),
+               get(jdepo, "y", 0.0),
+               get(jdepo, "z", 0.0), 0.0};
+    std::vector<double> vals;
+    for (const auto& key : m_adapter->keys()) {
+        vals.push_back(jdepo[key].asDouble());
+    }
+    std::vector<const double*> cols;
+    for (const auto& val : vals) {
+        cols.push_back(&val);
+    }
+    (*m_adapter)(1, cols.data(), &rec.q);
+    return rec;
+}
+
+IDepo::pointer Sio::JsonDepoSource::make_depo(const Record& rec)
+{
+    const Point pos(rec.x, rec.y, rec.z);
+    if (m_arena) {
+        return m_arena->make(rec.t, pos, rec.q);
+    }
+    return std::make_shared<SimpleDepo>(rec.t, pos, rec.q);
+}
+
 IDepo::pointer Sio::JsonDepoSource::jdepo2idepo(Json::Value jdepo)
 {
-    const double q = (*m_adapter)(jdepo);
-    auto idepo = std::make_shared<SimpleDepo>(
-        get(jdepo,"t",0.0),
-        Point(get(jdepo, "x", 0.0),
-              get(jdepo, "y", 0.0),
-              get(jdepo, "z", 0.0)),
-        q);
-    return idepo;
+    return make_depo(jdepo2record(jdepo));
 }
 
     
 
 void Sio::JsonDepoSource::configure(const WireCell::Configuration& cfg)
 {
-    m_depos.clear();
+    clear();
     if (m_adapter) {
         delete m_adapter;
         m_adapter = nullptr;
@@ -128,43 +408,35 @@ void Sio::JsonDepoSource::configure(const WireCell::Configuration& cfg)
 
     if (model_type == "electrons") { // "n" already gives number of ionization electrons
         double scale = get(cfg,"scale",1.0);
-        cerr << "Sio::JsonDepoSource: using electrons with scale=" << scale << endl;
-        m_adapter = new ElectronsAdapter(scale);
+        l->debug("JsonDepoSource: using electrons with scale={}", scale);
+        m_adapter = new ElectronsAdapter(ElectronsCharge{scale}, "n");
     }
     else {
         auto model = Factory::lookup_tn<IRecombinationModel>(model_tn);
         if (!model) {
-            cerr << "Sio::JsonDepoSource::configure: unknown recombination model: \"" << model_tn << "\"\n";
+            l->warn("JsonDepoSource: unknown recombination model: \"{}\"", model_tn);
             return;
         }
         if (model_type == "MipRecombination") {
-            m_adapter = new PointAdapter(model);
+            m_adapter = new PointAdapter(PointCharge{model}, "q");
         }
         if (model_type == "BirksRecombination" || model_type == "BoxRecombination") {
-            m_adapter = new StepAdapter(model);
+            m_adapter = new StepAdapter(StepCharge{model}, "q", "s");
         }
     }
 
-    // get and load JSON file.
-    string filename = get<string>(cfg,"filename");
-    string dotpath = get<string>(cfg,"jsonpath","depos");
-    if (filename.empty()) {
-        cerr << "JsonDepoSource::configure: no JSON filename given" << endl;
+    // The JSON file is read on first use.
+    m_filename = get<string>(cfg,"filename");
+    m_dotpath = get<string>(cfg,"jsonpath","depos");
+    if (m_filename.empty()) {
+        l->warn("JsonDepoSource: no JSON filename given");
         return;                 // fixme: uh, error handle much?
     }
-    Json::Value top = WireCell::Persist::load(filename.c_str());
-
-    double qtot = 0;
-    auto jdepos = branch(top, dotpath);
-    for (auto jdepo : jdepos) {
-        auto idepo = jdepo2idepo(jdepo);
-        m_depos.push_back(idepo);
-        qtot += idepo->charge();
-    }            
-    std::sort(m_depos.begin(), m_depos.end(), descending_time);
-    cerr << "Sio::JsonDepoSource::configure: "
-         << "slurped in " << m_depos.size() << " depositions, "
-         << " = " << -1*qtot/units::eplus << " electrons\n";
+    m_stream = get(cfg, "stream", false);
+    m_window_size = get(cfg, "window", 0);
+    if (get(cfg, "arena", false)) {
+        m_arena.reset(new DepoArena(arena_block));
+    }
 }
 
 
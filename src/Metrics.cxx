@@ -0,0 +1,136 @@
+#include "WireCellSio/Metrics.h"
+
+#include "WireCellUtil/Configuration.h"
+
+#include <algorithm>
+#include <memory>
+#include <sstream>
+
+using namespace WireCell;
+
+Sio::Metrics::Metrics(const std::string& component)
+    : m_component(component)
+    , m_neos(0)
+    , m_marked(false)
+    , l(Log::logger("io"))
+{
+}
+
+void Sio::Metrics::add(const std::string& name, double value)
+{
+    auto it = m_values.find(name);
+    if (it == m_values.end()) {
+        m_values[name] = Value{value, false};
+        return;
+    }
+    it->second.value += value;
+}
+
+void Sio::Metrics::peak(const std::string& name, double value)
+{
+    auto it = m_values.find(name);
+    if (it == m_values.end()) {
+        m_values[name] = Value{value, true};
+        return;
+    }
+    it->second.value = std::max(it->second.value, value);
+}
+
+void Sio::Metrics::rate(const std::string& name, const std::string& count,
+                        const std::string& seconds)
+{
+    m_rates.emplace_back(name, count, seconds);
+}
+
+Sio::Metrics::Timer::Timer(Metrics& metrics, const std::string& name)
+    : m_metrics(metrics)
+    , m_name(name)
+    , m_start(std::chrono::steady_clock::now())
+{
+}
+
+Sio::Metrics::Timer::~Timer()
+{
+    const std::chrono::duration<double> dt = std::chrono::steady_clock::now() - m_start;
+    m_metrics.add(m_name, dt.count());
+}
+
+void Sio::Metrics::fold()
+{
+    for (const auto& nv : m_values) {
+        auto it = m_totals.find(nv.first);
+        if (it == m_totals.end()) {
+            m_totals.insert(nv);
+        }
+        else if (nv.second.is_peak) {
+            it->second.value = std::max(it->second.value, nv.second.value);
+        }
+        else {
+            it->second.value += nv.second.value;
+        }
+    }
+    m_values.clear();
+}
+
+void Sio::Metrics::eos()
+{
+    if (m_values.empty()) {     // at most a mark() with nothing done
+        m_marked = false;
+        return;
+    }
+    ++m_neos;
+    if (m_marked) {
+        const std::chrono::duration<double> dt = std::chrono::steady_clock::now() - m_start;
+        add("span_s", dt.count());
+        m_marked = false;
+    }
+    report("eos", m_values, m_neos);
+    fold();
+}
+
+void Sio::Metrics::finalize()
+{
+    if (m_marked) {
+        const std::chrono::duration<double> dt = std::chrono::steady_clock::now() - m_start;
+        add("span_s", dt.count());
+        m_marked = false;
+    }
+    fold();
+    report("finalize", m_totals, m_neos);
+}
+
+void Sio::Metrics::report(const std::string& event, const values_t& values, int neos) const
+{
+    Configuration jreport;
+    jreport["component"] = m_component;
+    jreport["event"] = event;
+    jreport["eos"] = neos;
+    for (const auto& nv : values) {
+        jreport[nv.first] = nv.second.value;
+    }
+    for (const auto& rate : m_rates) {
+        auto count = values.find(std::get<1>(rate));
+        auto seconds = values.find(std::get<2>(rate));
+        if (count == values.end() or seconds == values.end() or seconds->second.value <= 0) {
+            continue;
+        }
+        jreport[std::get<0>(rate)] = count->second.value / seconds->second.value;
+    }
+
+    Json::StreamWriterBuilder wbuilder;
+    wbuilder["indentation"] = "";
+    std::unique_ptr<Json::StreamWriter> writer(wbuilder.newStreamWriter());
+    std::stringstream ss;
+    writer->write(jreport, &ss);
+    l->info("{}", ss.str());
+}
+
+void Sio::add_stats(Metrics& metrics, const NpzWriter::Stats& stats)
+{
+    metrics.add("entries", stats.entries);
+    metrics.add("bytes_in", stats.bytes_in);
+    metrics.add("bytes_out", stats.bytes_out);
+    metrics.add("compress_s", stats.compress_s);
+    metrics.add("write_s", stats.write_s);
+    metrics.add("queue_wait_s", stats.queue_wait_s);
+}
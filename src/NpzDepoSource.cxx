@@ -0,0 +1,204 @@
+#include "WireCellSio/NpzDepoSource.h"
+#include "WireCellSio/NpzReader.h"
+
+#include "WireCellIface/SimpleDepo.h"
+#include "WireCellUtil/NamedFactory.h"
+#include "WireCellUtil/Exceptions.h"
+
+#include "WireCellUtil/Point.h"
+
+WIRECELL_FACTORY(NpzDepoSource, WireCell::Sio::NpzDepoSource,
+                 WireCell::IDepoSource, WireCell::IConfigurable, WireCell::ITerminal)
+
+#include <algorithm>
+#include <set>
+#include <string>
+
+using namespace WireCell;
+
+Sio::NpzDepoSource::NpzDepoSource()
+    : m_policy("")
+    , m_metrics("NpzDepoSource")
+{
+    m_metrics.rate("depos_per_s", "depos", "span_s");
+    m_metrics.rate("decode_depos_per_s", "depos", "decode_s");
+}
+
+Sio::NpzDepoSource::~NpzDepoSource()
+{
+}
+
+bool Sio::NpzDepoSource::operator()(IDepo::pointer& out)
+{
+    out = nullptr;
+
+    if (m_depos.size() > 0) {
+        out = m_depos.back();
+        m_depos.pop_back();
+        if (!out) {
+            m_metrics.eos();
+        }
+        return true;
+    }
+
+    // refill
+    while (!m_saves.empty()) {
+        const int save = m_saves.back();
+        m_saves.pop_back();
+        m_metrics.mark();
+        {
+            Metrics::Timer timer(m_metrics, "decode_s");
+            load(save);
+        }
+        m_metrics.add("saves", 1);
+        m_metrics.add("depos", m_depos.size());
+        m_metrics.peak("peak_buffered_depos", m_depos.size());
+        if (m_depos.empty()) {
+            continue;
+        }
+        if (m_policy != "stream") {
+            m_depos.push_back(nullptr); // chunk by save
+        }
+        std::reverse(m_depos.begin(), m_depos.end());
+        break;
+    }
+
+    if (m_depos.empty()) {
+        m_metrics.eos();
+        return false;
+    }
+
+    out = m_depos.back();
+    m_depos.pop_back();
+    return true;
+}
+
+void Sio::NpzDepoSource::finalize()
+{
+    m_metrics.finalize();
+}
+
+WireCell::Configuration Sio::NpzDepoSource::default_configuration() const
+{
+    Configuration cfg;
+    cfg["filename"] = "";       // npz file as written by NumpyDepoSaver
+    cfg["policy"] = ""; // set to "stream" to avoid sending EOS after each save's worth of depos.
+    return cfg;
+}
+
+void Sio::NpzDepoSource::configure(const WireCell::Configuration& cfg)
+{
+    const std::string filename = get<std::string>(cfg, "filename");
+    m_policy = get<std::string>(cfg, "policy", "");
+    m_reader.reset(new NpzReader(filename));
+
+    const std::string prefix = "depo_data_";
+    std::set<int> saves;
+    for (const auto& name : m_reader->names()) {
+        if (name.compare(0, prefix.size(), prefix) != 0) {
+            continue;
+        }
+        saves.insert(std::stoi(name.substr(prefix.size())));
+    }
+    m_saves.assign(saves.rbegin(), saves.rend()); // to use pop_back().
+    m_depos.clear();
+}
+
+// Append the columns of one part to the columnar buffer.  Both are
+// shaped (ncols, nrows) and so one column is contiguous.
+template<typename T>
+static void append_columns(std::vector< std::vector<T> >& cols, const Sio::NpzReader::Array& arr)
+{
+    if (!arr.is_type<T>() or arr.shape.size() != 2 or arr.fortran_order) {
+        THROW(ValueError() << errmsg{"NpzDepoSource: unexpected array " + arr.name});
+    }
+    const size_t ncols = arr.shape[0], nrows = arr.shape[1];
+    if (cols.empty()) {
+        cols.resize(ncols);
+    }
+    if (cols.size() != ncols) {
+        THROW(ValueError() << errmsg{"NpzDepoSource: inconsistent chunk " + arr.name});
+    }
+    for (size_t icol=0; icol<ncols; ++icol) {
+        auto& col = cols[icol];
+        const size_t beg = col.size();
+        col.resize(beg + nrows);
+        std::memcpy(col.data() + beg, arr.data + icol*nrows*sizeof(T), nrows*sizeof(T));
+    }
+}
+
+void Sio::NpzDepoSource::load(int save)
+{
+    m_depos.clear();
+
+    std::vector< std::vector<float> > data; // time, charge, x, y, z, dlong, dtran
+    std::vector< std::vector<int> > info;   // ID, pdg, gen, child[, prior]
+
+    const std::string dname = String::format("depo_data_%d", save);
+    const std::string iname = String::format("depo_info_%d", save);
+    if (m_reader->has(dname)) {
+        append_columns(data, m_reader->get(dname));
+        append_columns(info, m_reader->get(iname));
+    }
+    else {
+        for (int chunk=0; ; ++chunk) {
+            const std::string cname = String::format("_chunk%d", chunk);
+            if (!m_reader->has(dname + cname)) {
+                break;
+            }
+            append_columns(data, m_reader->get(dname + cname));
+            append_columns(info, m_reader->get(iname + cname));
+        }
+    }
+    if (data.size() < 7 or info.size() < 4 or data[0].size() != info[0].size()) {
+        THROW(ValueError() << errmsg{"NpzDepoSource: malformed depos for save " + std::to_string(save)});
+    }
+    const int nrows = data[0].size();
+    const auto& gen = info[2];
+
+    // Row of each row's prior or -1.
+    std::vector<int> prior(nrows, -1);
+    if (info.size() >= 5) {
+        for (int irow=0; irow<nrows; ++irow) {
+            prior[irow] = info[4][irow] - 1;
+        }
+    }
+    else {                      // prior follows its child
+        const auto& child = info[3];
+        for (int irow=0; irow+1<nrows; ++irow) {
+            if (gen[irow+1] == gen[irow]+1 and child[irow+1] == irow+1) {
+                prior[irow] = irow+1;
+            }
+        }
+    }
+
+    IDepo::vector made(nrows, nullptr);
+    std::vector<int> todo;
+    for (int irow=0; irow<nrows; ++irow) {
+        if (gen[irow] != 0) {
+            continue;
+        }
+        // Make any not yet made priors, oldest first.
+        for (int row = irow; row >= 0; row = prior[row]) {
+            if (row >= nrows or (int)todo.size() >= nrows) {
+                THROW(ValueError() << errmsg{"NpzDepoSource: bad prior in save " + std::to_string(save)});
+            }
+            if (made[row]) {
+                break;
+            }
+            todo.push_back(row);
+        }
+        while (!todo.empty()) {
+            const int row = todo.back();
+            todo.pop_back();
+            IDepo::pointer pdepo = prior[row] < 0 ? nullptr : made[prior[row]];
+            made[row] = std::make_shared<SimpleDepo>(
+                data[0][row],
+                Point(data[2][row], data[3][row], data[4][row]),
+                data[1][row], pdepo,
+                data[5][row], data[6][row],
+                info[0][row], info[1][row]);
+        }
+        m_depos.push_back(made[irow]);
+    }
+}
@@ -0,0 +1,70 @@
+#include "WireCellSio/NpzIndex.h"
+
+#include "WireCellUtil/Persist.h"
+
+using namespace WireCell;
+
+std::string Sio::NpzIndex::sidecar(const std::string& npzname)
+{
+    return npzname + ".index.json";
+}
+
+Configuration Sio::NpzIndex::load(const std::string& npzname)
+{
+    const std::string fname = sidecar(npzname);
+    if (!Persist::exists(fname)) {
+        return Configuration();
+    }
+    return Persist::load(fname);
+}
+
+void Sio::NpzIndex::open(const std::string& npzname, bool appending)
+{
+    if (appending and npzname == m_npzname) {
+        return;
+    }
+    m_npzname = npzname;
+    m_index = Configuration();
+    if (appending) {            // keep what is indexed
+        m_index = load(npzname);
+    }
+    if (m_index.isNull()) {
+        m_index["saves"] = Json::arrayValue;
+        m_index["entries"] = Json::objectValue;
+    }
+    m_index["npz"] = npzname;
+    if (!appending) {           // a stale index must not describe the new file
+        write();
+    }
+}
+
+void Sio::NpzIndex::add_save(const Configuration& jsave)
+{
+    m_index["saves"].append(jsave);
+}
+
+void Sio::NpzIndex::add_entries(const std::vector<NpzWriter::EntryInfo>& entries)
+{
+    for (const auto& info : entries) {
+        Configuration jent;
+        jent["offset"] = (Json::UInt64)info.offset;
+        jent["length"] = (Json::UInt64)info.length;
+        jent["size"] = (Json::UInt64)info.size;
+        jent["header"] = (Json::UInt64)info.header;
+        jent["method"] = info.method;
+        jent["dtype"] = info.descr;
+        jent["shape"] = Json::arrayValue;
+        for (auto n : info.shape) {
+            jent["shape"].append((Json::UInt64)n);
+        }
+        m_index["entries"][info.name] = jent;
+    }
+}
+
+void Sio::NpzIndex::write() const
+{
+    if (m_npzname.empty()) {
+        return;
+    }
+    Persist::dump(sidecar(m_npzname), m_index);
+}
@@ -0,0 +1,219 @@
+#include "WireCellSio/NpzReader.h"
+
+#include <zlib.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdint>
+
+using namespace WireCell;
+
+static uint16_t get16(const char* buf)
+{
+    const unsigned char* b = reinterpret_cast<const unsigned char*>(buf);
+    return b[0] | (b[1] << 8);
+}
+static uint32_t get32(const char* buf)
+{
+    return get16(buf) | (uint32_t(get16(buf+2)) << 16);
+}
+
+namespace {
+    // Owns a read-only mapping of a whole file.
+    struct Mapping {
+        void* addr;
+        size_t size;
+        ~Mapping() { munmap(addr, size); }
+    };
+}
+
+size_t Sio::NpzReader::Array::word_size() const
+{
+    return descr.size() > 2 ? std::stoul(descr.substr(2)) : 0;
+}
+
+Sio::NpzReader::NpzReader(const std::string& filename)
+    : m_filename(filename)
+    , m_base(nullptr)
+    , m_size(0)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        THROW(IOError() << errmsg{"NpzReader: failed to open " + filename});
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 or st.st_size < 22) {
+        ::close(fd);
+        THROW(IOError() << errmsg{"NpzReader: not an npz file: " + filename});
+    }
+    m_size = st.st_size;
+    void* addr = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        THROW(IOError() << errmsg{"NpzReader: failed to map " + filename});
+    }
+    m_map = std::shared_ptr<Mapping>(new Mapping{addr, m_size});
+    m_base = static_cast<const char*>(addr);
+
+    // Find the end of central directory record, allowing for a comment.
+    const char* eocd = nullptr;
+    for (size_t back = 22; back <= m_size and back < 22 + 0xffff; ++back) {
+        const char* p = m_base + m_size - back;
+        if (get32(p) == 0x06054b50) {
+            eocd = p;
+            break;
+        }
+    }
+    if (!eocd) {
+        THROW(IOError() << errmsg{"NpzReader: no zip directory in " + filename});
+    }
+    const size_t dirsize = get32(eocd+12);
+    const size_t diroff = get32(eocd+16);
+    if (diroff + dirsize > m_size) {
+        THROW(IOError() << errmsg{"NpzReader: corrupt zip directory in " + filename});
+    }
+
+    // The record count may have wrapped so walk by size.
+    const char* rec = m_base + diroff;
+    const char* end = rec + dirsize;
+    while (rec + 46 <= end and get32(rec) == 0x02014b50) {
+        Entry ent;
+        ent.method = get16(rec+10);
+        ent.csize = get32(rec+20);
+        ent.usize = get32(rec+24);
+        const size_t nlen = get16(rec+28), xlen = get16(rec+30), clen = get16(rec+32);
+        ent.offset = get32(rec+42);
+        std::string name(rec+46, nlen);
+        rec += 46 + nlen + xlen + clen;
+
+        if (name.size() > 4 and name.substr(name.size()-4) == ".npy") {
+            name = name.substr(0, name.size()-4);
+        }
+        if (!m_entries.count(name)) {
+            m_order.push_back(name);
+        }
+        m_entries[name] = ent;  // like numpy, last one wins
+    }
+}
+
+Sio::NpzReader::~NpzReader()
+{
+}
+
+std::vector<std::string> Sio::NpzReader::names() const
+{
+    return m_order;
+}
+
+bool Sio::NpzReader::has(const std::string& name) const
+{
+    return m_entries.count(name) > 0;
+}
+
+// Parse the .npy header and set the array description.  Return the
+// size of the header.
+static size_t parse_npy_header(const char* buf, size_t size, Sio::NpzReader::Array& arr)
+{
+    if (size < 10 or std::memcmp(buf, "\x93NUMPY", 6) != 0) {
+        THROW(IOError() << errmsg{"NpzReader: not a npy array: " + arr.name});
+    }
+    const int major = buf[6];
+    size_t hlen = 0, hbeg = 0;
+    if (major == 1) {
+        hlen = get16(buf+8);
+        hbeg = 10;
+    }
+    else {
+        hlen = get32(buf+8);
+        hbeg = 12;
+    }
+    if (hbeg + hlen > size) {
+        THROW(IOError() << errmsg{"NpzReader: corrupt npy header: " + arr.name});
+    }
+    const std::string dict(buf+hbeg, hlen);
+
+    auto loc = dict.find("'descr'");
+    loc = dict.find('\'', dict.find(':', loc)) + 1;
+    arr.descr = dict.substr(loc, dict.find('\'', loc) - loc);
+
+    loc = dict.find("'fortran_order'");
+    arr.fortran_order = dict.substr(dict.find(':', loc)+1, 5).find("True") != std::string::npos;
+
+    loc = dict.find("'shape'");
+    const size_t lp = dict.find('(', loc), rp = dict.find(')', loc);
+    std::string shape = dict.substr(lp+1, rp-lp-1);
+    arr.shape.clear();
+    size_t pos = 0;
+    while (pos < shape.size()) {
+        size_t comma = shape.find(',', pos);
+        if (comma == std::string::npos) {
+            comma = shape.size();
+        }
+        const std::string num = shape.substr(pos, comma-pos);
+        if (num.find_first_of("0123456789") != std::string::npos) {
+            arr.shape.push_back(std::stoul(num));
+        }
+        pos = comma + 1;
+    }
+    return hbeg + hlen;
+}
+
+Sio::NpzReader::Array Sio::NpzReader::get(const std::string& name) const
+{
+    auto it = m_entries.find(name);
+    if (it == m_entries.end()) {
+        THROW(IndexError() << errmsg{"NpzReader: no array " + name + " in " + m_filename});
+    }
+    const Entry& ent = it->second;
+
+    const char* local = m_base + ent.offset;
+    if (ent.offset + 30 > m_size or get32(local) != 0x04034b50) {
+        THROW(IOError() << errmsg{"NpzReader: corrupt entry " + name + " in " + m_filename});
+    }
+    const size_t beg = ent.offset + 30 + get16(local+26) + get16(local+28);
+    if (beg + ent.csize > m_size) {
+        THROW(IOError() << errmsg{"NpzReader: truncated entry " + name + " in " + m_filename});
+    }
+
+    Array arr;
+    arr.name = name;
+    const char* bytes = m_base + beg;
+    size_t nbytes = ent.csize;
+
+    if (ent.method == 0) {
+        arr.holder = m_map;
+    }
+    else if (ent.method == 8) {
+        auto buf = std::make_shared<std::vector<char>>(ent.usize);
+        z_stream zs;
+        std::memset(&zs, 0, sizeof(zs));
+        inflateInit2(&zs, -MAX_WBITS);
+        zs.next_in = (Bytef*)bytes;
+        zs.avail_in = ent.csize;
+        zs.next_out = (Bytef*)buf->data();
+        zs.avail_out = buf->size();
+        const int rc = inflate(&zs, Z_FINISH);
+        inflateEnd(&zs);
+        if (rc != Z_STREAM_END) {
+            THROW(IOError() << errmsg{"NpzReader: failed to inflate " + name + " in " + m_filename});
+        }
+        bytes = buf->data();
+        nbytes = buf->size();
+        arr.holder = buf;
+    }
+    else {
+        THROW(IOError() << errmsg{"NpzReader: unsupported compression for " + name
+                    + " in " + m_filename});
+    }
+
+    const size_t hsize = parse_npy_header(bytes, nbytes, arr);
+    arr.data = bytes + hsize;
+    arr.nbytes = nbytes - hsize;
+    if (arr.num_vals() * arr.word_size() > arr.nbytes) {
+        THROW(IOError() << errmsg{"NpzReader: truncated array " + name + " in " + m_filename});
+    }
+    return arr;
+}
@@ -0,0 +1,520 @@
+#include "WireCellSio/NpzWriter.h"
+
+#include "WireCellUtil/Exceptions.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+using namespace WireCell;
+
+// Zip fields are little endian.
+static void put16(std::vector<char>& buf, uint16_t val)
+{
+    buf.push_back(val & 0xff);
+    buf.push_back((val >> 8) & 0xff);
+}
+static void put32(std::vector<char>& buf, uint32_t val)
+{
+    put16(buf, val & 0xffff);
+    put16(buf, (val >> 16) & 0xffff);
+}
+static uint16_t get16(const char* buf)
+{
+    const unsigned char* b = reinterpret_cast<const unsigned char*>(buf);
+    return b[0] | (b[1] << 8);
+}
+static uint32_t get32(const char* buf)
+{
+    return get16(buf) | (uint32_t(get16(buf+2)) << 16);
+}
+
+static const size_t footer_size = 22;
+
+// Find the dtype and shape in a .npy header as made by cnpy.
+static void parse_npy_header(const std::vector<char>& header,
+                             std::string& descr, std::vector<size_t>& shape)
+{
+    const std::string dict(header.begin(), header.end());
+    const std::string dkey = "'descr': '";
+    size_t pos = dict.find(dkey);
+    if (pos != std::string::npos) {
+        pos += dkey.size();
+        descr = dict.substr(pos, dict.find('\'', pos) - pos);
+    }
+    pos = dict.find("'shape': (");
+    if (pos == std::string::npos) {
+        return;
+    }
+    const size_t end = dict.find(')', pos);
+    pos = dict.find('(', pos) + 1;
+    while (pos < end) {
+        const size_t next = std::min(dict.find(',', pos), end);
+        const std::string num = dict.substr(pos, next - pos);
+        if (num.find_first_of("0123456789") != std::string::npos) {
+            shape.push_back(std::stoul(num));
+        }
+        pos = next + 1;
+    }
+}
+
+typedef std::chrono::steady_clock clock_type;
+static double seconds_since(clock_type::time_point start)
+{
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+// Compress header+data as one raw deflate stream into out.
+static void deflate_bytes(int level, const std::vector<char>& header,
+                          const char* data, size_t size, std::vector<char>& out)
+{
+    z_stream strm{};
+    if (deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        THROW(IOError() << errmsg{"NpzWriter: failed to initialize deflate"});
+    }
+    out.resize(deflateBound(&strm, header.size() + size));
+    strm.next_out = (Bytef*)out.data();
+    strm.avail_out = out.size();
+
+    strm.next_in = (Bytef*)header.data();
+    strm.avail_in = header.size();
+    int rc = deflate(&strm, Z_NO_FLUSH);
+    if (rc == Z_OK) {
+        strm.next_in = (Bytef*)data;
+        strm.avail_in = size;
+        rc = deflate(&strm, Z_FINISH);
+    }
+    const size_t nout = strm.total_out;
+    deflateEnd(&strm);
+    if (rc != Z_STREAM_END) {
+        THROW(IOError() << errmsg{"NpzWriter: failed to deflate entry"});
+    }
+    out.resize(nout);
+}
+
+static void check_entry_size(const std::string& name, size_t nbytes)
+{
+    if (nbytes > std::numeric_limits<uint32_t>::max()) {
+        THROW(IOError() << errmsg{"NpzWriter: array too large for zip: " + name});
+    }
+}
+
+Sio::NpzWriter::NpzWriter()
+    : m_fp(nullptr)
+    , m_nrecs(0)
+    , m_offset(0)
+    , m_dirty(false)
+    , m_appending(false)
+    , m_level(0)
+    , m_depth(0)
+    , m_busy(false)
+    , m_stop(false)
+    , m_size(0)
+{
+}
+
+Sio::NpzWriter::~NpzWriter()
+{
+    try {
+        close();
+    }
+    catch (...) {               // can not throw from destructor
+    }
+}
+
+void Sio::NpzWriter::open(const std::string& filename, size_t queue_depth, int level)
+{
+    close();
+
+    if (level < 0 or level > 9) {
+        THROW(ValueError() << errmsg{"NpzWriter: compression level must be 0-9"});
+    }
+    m_level = level;
+
+    m_directory.clear();
+    m_nrecs = 0;
+    m_offset = 0;
+    m_dirty = false;
+    m_appending = false;
+    m_depth = queue_depth;
+    m_error = nullptr;
+    m_stats = Stats();
+    m_written.clear();
+
+    m_fp = fopen(filename.c_str(), "r+b");
+    if (!m_fp) {
+        m_fp = fopen(filename.c_str(), "wb");
+    }
+    if (!m_fp) {
+        THROW(IOError() << errmsg{"NpzWriter: failed to open " + filename});
+    }
+    m_filename = filename;
+
+    fseek(m_fp, 0, SEEK_END);
+    const long fsize = ftell(m_fp);
+    if (fsize == 0) {           // new file, make it a valid archive on close
+        m_dirty = true;
+    }
+    else {
+        read_directory(fsize);
+        m_appending = true;
+    }
+    m_size = m_offset;
+
+    if (m_depth) {
+        m_stop = false;
+        m_thread = std::thread(&Sio::NpzWriter::drain, this);
+    }
+}
+
+int Sio::NpzWriter::codec_level(const std::string& codec, int level)
+{
+    if (codec == "store") {
+        return 0;
+    }
+    if (codec == "deflate") {
+        if (level < 1 or level > 9) {
+            THROW(ValueError() << errmsg{"NpzWriter: deflate level must be 1-9"});
+        }
+        return level;
+    }
+    THROW(ValueError() << errmsg{"NpzWriter: unsupported codec: " + codec});
+}
+
+void Sio::NpzWriter::read_directory(long fsize)
+{
+    // Existing archive.  Like cnpy, assume no zip comment.
+    std::vector<char> footer(footer_size);
+    if (fsize < (long)footer_size
+        or fseek(m_fp, -(long)footer_size, SEEK_END) != 0
+        or fread(footer.data(), 1, footer_size, m_fp) != footer_size
+        or get32(footer.data()) != 0x06054b50) {
+        fclose(m_fp);
+        m_fp = nullptr;
+        THROW(IOError() << errmsg{"NpzWriter: not an npz file: " + m_filename});
+    }
+    m_nrecs = get16(footer.data()+10);
+    const size_t dirsize = get32(footer.data()+12);
+    m_offset = get32(footer.data()+16);
+
+    m_directory.resize(dirsize);
+    fseek(m_fp, m_offset, SEEK_SET);
+    if (fread(m_directory.data(), 1, dirsize, m_fp) != dirsize) {
+        fclose(m_fp);
+        m_fp = nullptr;
+        THROW(IOError() << errmsg{"NpzWriter: failed to read directory of " + m_filename});
+    }
+}
+
+Sio::NpzWriter::Prepared Sio::NpzWriter::prepare_bytes(const std::string& name,
+                                                        const std::vector<char>& header,
+                                                        const char* data, size_t size, int level,
+                                                        bool copy)
+{
+    if (level < 0 or level > 9) {
+        THROW(ValueError() << errmsg{"NpzWriter: compression level must be 0-9"});
+    }
+    Prepared entry;
+    entry.name = name;
+    entry.header = header;
+    entry.size = header.size() + size;
+    check_entry_size(name, entry.size);
+    entry.crc = crc32(0L, (const Bytef*)header.data(), header.size());
+    entry.crc = crc32(entry.crc, (const Bytef*)data, size);
+    if (level) {
+        const auto start = clock_type::now();
+        deflate_bytes(level, header, data, size, entry.stored);
+        entry.method = 8;
+        entry.compress_s = seconds_since(start);
+    }
+    else {
+        entry.stored = header;
+        if (copy) {
+            entry.stored.insert(entry.stored.end(), data, data+size);
+        }
+    }
+    return entry;
+}
+
+void Sio::NpzWriter::write(Prepared entry)
+{
+    if (!m_depth) {
+        append_prepared(entry);
+        return;
+    }
+    enqueue(Entry{std::move(entry), true});
+}
+
+void Sio::NpzWriter::append_prepared(const Prepared& entry)
+{
+    // Any bytes not in "stored" are the kept data.
+    const size_t nkept = entry.method ? 0 : entry.size - entry.stored.size();
+    append_entry(entry.name, entry.header, entry.crc, entry.method, entry.size,
+                 entry.stored.data(), entry.stored.size(),
+                 static_cast<const char*>(entry.data.get()), nkept, entry.compress_s);
+}
+
+void Sio::NpzWriter::submit(const std::string& name, const std::vector<char>& header,
+                            const char* data, size_t size)
+{
+    if (!m_depth) {
+        write_entry(name, header, data, size);
+        return;
+    }
+    Entry entry{Prepared(), false};
+    entry.prepared.name = name;
+    entry.prepared.header = header;
+    entry.prepared.stored.assign(data, data+size);
+    enqueue(std::move(entry));
+}
+
+void Sio::NpzWriter::enqueue(Entry entry)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    const auto start = clock_type::now();
+    m_cond.wait(lock, [this]{ return m_queue.size() < m_depth or m_error; });
+    m_stats.queue_wait_s += seconds_since(start);
+    if (m_error) {
+        lock.unlock();
+        rethrow();
+    }
+    m_queue.push_back(std::move(entry));
+    lock.unlock();
+    m_cond.notify_all();
+}
+
+void Sio::NpzWriter::drain()
+{
+    while (true) {
+        Entry entry;
+        bool failed = false;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this]{ return m_stop or !m_queue.empty(); });
+            if (m_queue.empty()) {
+                return;         // stopped
+            }
+            entry = std::move(m_queue.front());
+            m_queue.pop_front();
+            m_busy = true;
+            failed = (bool)m_error;
+        }
+        m_cond.notify_all();    // room in queue
+
+        std::exception_ptr error;
+        if (!failed) {          // once failed, discard the rest
+            try {
+                const auto& pe = entry.prepared;
+                if (entry.ready) {
+                    append_prepared(pe);
+                }
+                else {
+                    write_entry(pe.name, pe.header, pe.stored.data(), pe.stored.size());
+                }
+            }
+            catch (...) {
+                error = std::current_exception();
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (error) {
+                m_error = error;
+            }
+            m_busy = false;
+        }
+        m_cond.notify_all();
+    }
+}
+
+void Sio::NpzWriter::wait_idle()
+{
+    if (!m_depth) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cond.wait(lock, [this]{ return m_queue.empty() and !m_busy; });
+}
+
+void Sio::NpzWriter::rethrow()
+{
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::swap(error, m_error);
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void Sio::NpzWriter::write_entry(const std::string& name, const std::vector<char>& header,
+                                 const char* data, size_t size)
+{
+    const size_t nbytes = header.size() + size;
+    check_entry_size(name, nbytes);
+
+    uint32_t crc = crc32(0L, (const Bytef*)header.data(), header.size());
+    crc = crc32(crc, (const Bytef*)data, size);
+
+    if (!m_level) {
+        append_entry(name, header, crc, 0, nbytes,
+                     header.data(), header.size(), data, size, 0);
+        return;
+    }
+    const auto start = clock_type::now();
+    deflate_bytes(m_level, header, data, size, m_deflated);
+    append_entry(name, header, crc, 8, nbytes,
+                 m_deflated.data(), m_deflated.size(), nullptr, 0, seconds_since(start));
+}
+
+void Sio::NpzWriter::append_entry(const std::string& name, const std::vector<char>& header,
+                                  uint32_t crc, int method, size_t nbytes,
+                                  const char* piece1, size_t size1,
+                                  const char* piece2, size_t size2, double compress_s)
+{
+    if (!m_fp) {
+        THROW(IOError() << errmsg{"NpzWriter: write to closed file: " + name});
+    }
+    const std::string fname = name + ".npy";
+    const size_t nstored = size1 + size2;
+
+    std::vector<char> local;
+    put32(local, 0x04034b50);   // signature
+    put16(local, 20);           // version needed to extract
+    put16(local, 0);            // general purpose bit flag
+    put16(local, method);       // compression method: deflate or stored
+    put16(local, 0);            // last mod time
+    put16(local, 0);            // last mod date
+    put32(local, crc);
+    put32(local, nstored);      // compressed size
+    put32(local, nbytes);       // uncompressed size
+    put16(local, fname.size());
+    put16(local, 0);            // extra field length
+    local.insert(local.end(), fname.begin(), fname.end());
+
+    if (m_offset + local.size() + nstored > std::numeric_limits<uint32_t>::max()) {
+        THROW(IOError() << errmsg{"NpzWriter: zip file size limit reached in " + m_filename});
+    }
+
+    put32(m_directory, 0x02014b50); // signature
+    put16(m_directory, 20);         // version made by
+    m_directory.insert(m_directory.end(), local.begin()+4, local.begin()+30);
+    put16(m_directory, 0);          // file comment length
+    put16(m_directory, 0);          // disk number start
+    put16(m_directory, 0);          // internal file attributes
+    put32(m_directory, 0);          // external file attributes
+    put32(m_directory, m_offset);   // offset of local header
+    m_directory.insert(m_directory.end(), fname.begin(), fname.end());
+    ++m_nrecs;
+
+    EntryInfo info{name, m_offset + local.size(), nstored, nbytes, header.size(),
+                   method, "", {}};
+    parse_npy_header(header, info.descr, info.shape);
+
+    const auto start = clock_type::now();
+    fseek(m_fp, m_offset, SEEK_SET);
+    size_t nwrote = fwrite(local.data(), 1, local.size(), m_fp);
+    nwrote += fwrite(piece1, 1, size1, m_fp);
+    if (size2) {
+        nwrote += fwrite(piece2, 1, size2, m_fp);
+    }
+    if (nwrote != local.size() + nstored) {
+        THROW(IOError() << errmsg{"NpzWriter: short write to " + m_filename});
+    }
+    m_offset += nwrote;
+    m_dirty = true;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_size = m_offset;
+    m_written.push_back(std::move(info));
+    ++m_stats.entries;
+    m_stats.bytes_in += nbytes;
+    m_stats.bytes_out += nwrote;
+    m_stats.compress_s += compress_s;
+    m_stats.write_s += seconds_since(start);
+}
+
+std::vector<Sio::NpzWriter::EntryInfo> Sio::NpzWriter::take_entries()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<EntryInfo> ret;
+    ret.swap(m_written);
+    return ret;
+}
+
+size_t Sio::NpzWriter::size()
+{
+    wait_idle();
+    rethrow();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_size;
+}
+
+Sio::NpzWriter::Stats Sio::NpzWriter::take_stats()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Stats ret = m_stats;
+    m_stats = Stats();
+    return ret;
+}
+
+void Sio::NpzWriter::flush()
+{
+    wait_idle();
+    rethrow();
+    if (!m_fp or !m_dirty) {
+        return;
+    }
+    std::vector<char> footer;
+    put32(footer, 0x06054b50);  // signature
+    put16(footer, 0);           // number of this disk
+    put16(footer, 0);           // disk where directory starts
+    put16(footer, m_nrecs);     // records on this disk, wraps as in cnpy
+    put16(footer, m_nrecs);     // total records
+    put32(footer, m_directory.size());
+    put32(footer, m_offset);    // offset of directory
+    put16(footer, 0);           // comment length
+
+    const auto start = clock_type::now();
+    fseek(m_fp, m_offset, SEEK_SET);
+    size_t nwrote = fwrite(m_directory.data(), 1, m_directory.size(), m_fp);
+    nwrote += fwrite(footer.data(), 1, footer.size(), m_fp);
+    fflush(m_fp);
+    if (nwrote != m_directory.size() + footer.size()) {
+        THROW(IOError() << errmsg{"NpzWriter: failed to write directory to " + m_filename});
+    }
+    m_dirty = false;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.bytes_out += nwrote;
+    m_stats.write_s += seconds_since(start);
+}
+
+void Sio::NpzWriter::close()
+{
+    if (!m_fp) {
+        return;
+    }
+    if (m_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cond.notify_all();
+        m_thread.join();        // drains what remains in the queue
+    }
+    try {
+        flush();
+    }
+    catch (...) {
+        fclose(m_fp);
+        m_fp = nullptr;
+        throw;
+    }
+    fclose(m_fp);
+    m_fp = nullptr;
+}
@@ -2,22 +2,33 @@
 
 #include "WireCellIface/FrameTools.h"
 #include "WireCellUtil/NamedFactory.h"
-#include "WireCellUtil/cnpy.h"
+#include "WireCellUtil/Exceptions.h"
 
 #include <string>
 #include <vector>
 #include <algorithm>
-#include <iostream>
-#include <tuple>
+#include <unordered_set>
 
 WIRECELL_FACTORY(NumpyDepoSaver, WireCell::Sio::NumpyDepoSaver,
-                 WireCell::IDepoFilter, WireCell::IConfigurable)
+                 WireCell::IDepoFilter, WireCell::IConfigurable, WireCell::ITerminal)
 
 using namespace WireCell;
 
 Sio::NumpyDepoSaver::NumpyDepoSaver()
     : m_save_count(0)
+    , m_level(0)
+    , m_indexed(false)
+    , m_chunk_size(0)
+    , m_capacity(0)
+    , m_nrows(0)
+    , m_nflushed(0)
+    , m_chunk_count(0)
+    , m_ndepos(0)
+    , m_metrics("NumpyDepoSaver")
+    , l(Log::logger("io"))
 {
+    m_metrics.rate("depos_per_s", "depos", "span_s");
+    m_metrics.rate("rows_per_s", "rows", "flush_s");
 }
 
 Sio::NumpyDepoSaver::~NumpyDepoSaver()
@@ -33,7 +44,35 @@ WireCell::Configuration Sio::NumpyDepoSaver::default_configuration() const
     // files are supported.  Writing is always in "append" mode.  It's
     // up to the user to delete a previous instance of the file if
     // it's old contents are not wanted.
+    // The name may hold {count}, {ident} and {part} to write
+    // several files, see Rollover.h.
     cfg["filename"] = "wct-frame.npz";
+
+    // Once a file holds this many saves or this many bytes it is
+    // closed and the next save starts a new file.  Zero for no limit.
+    cfg["max_saves"] = 0;
+    cfg["max_bytes"] = 0;
+
+    // If true, each file is accompanied by an index of its saves and
+    // where their arrays are in the file, see NpzIndex.h.
+    cfg["index"] = false;
+
+    // If nonzero, arrays are written by a separate I/O thread and
+    // this many may be queued for writing.  EOS waits for the queue
+    // to drain.  Zero writes synchronously.
+    cfg["queue_depth"] = 0;
+
+    // How array entries are compressed.  "store" writes them as is,
+    // as cnpy does.  "deflate" compresses them at the zlib "level",
+    // 1 (fastest) to 9 (smallest), as numpy.savez_compressed does.
+    cfg["codec"] = "store";
+    cfg["level"] = 1;
+
+    // If nonzero, depos are not held until EOS but written as they
+    // arrive in chunks of this many rows (depos plus their priors).
+    // Memory is then bounded by the chunk size plus the depos and
+    // priors seen, which are held until EOS to save each only once.
+    cfg["chunk_size"] = 0;
         
     return cfg;
 }
@@ -41,28 +80,173 @@ WireCell::Configuration Sio::NumpyDepoSaver::default_configuration() const
 void Sio::NumpyDepoSaver::configure(const WireCell::Configuration& config)
 {
     m_cfg = config;
+    if (get(m_cfg, "queue_depth", 0) < 0) {
+        THROW(ValueError() << errmsg{"NumpyDepoSaver: queue_depth must not be negative"});
+    }
+    const int chunk_size = get(m_cfg, "chunk_size", 0);
+    if (chunk_size < 0) {
+        THROW(ValueError() << errmsg{"NumpyDepoSaver: chunk_size must not be negative"});
+    }
+    m_level = NpzWriter::codec_level(get<std::string>(m_cfg, "codec", "store"),
+                                     get(m_cfg, "level", 1));
+    m_roll.configure(m_cfg);
+    m_indexed = get(m_cfg, "index", false);
+    if (m_roll.fixed()) {
+        m_npz.open(m_roll.filename(0, 0), get(m_cfg, "queue_depth", 0), m_level);
+        if (m_indexed) {
+            m_index.open(m_npz.filename(), m_npz.appending());
+        }
+    }
+    else {                      // named by its first save
+        close_file();
+    }
+    m_chunk_size = chunk_size;
+    reserve(m_chunk_size);
+}
+
+
+// time, charge, x, y, z, dlong, dtran
+static const size_t ndata = 7;
+// ID, pdg, gen, child, prior
+static const size_t ninfo = 5;
+
+void Sio::NumpyDepoSaver::reserve(size_t nrows)
+{
+    m_capacity = nrows;
+    m_data.assign(ndata*nrows, 0);
+    m_info.assign(ninfo*nrows, 0);
+    m_nrows = 0;
+}
+
+void Sio::NumpyDepoSaver::push_row(const WireCell::IDepo::pointer& depo,
+                                   size_t gen, size_t childid, size_t priorid)
+{
+    if (m_nrows == m_capacity) {
+        flush_rows();
+    }
+    const size_t irow = m_nrows++;
+    const size_t n = m_capacity;
+    m_data[0*n + irow] = depo->time();
+    m_data[1*n + irow] = depo->charge();
+    m_data[2*n + irow] = depo->pos().x();
+    m_data[3*n + irow] = depo->pos().y();
+    m_data[4*n + irow] = depo->pos().z();
+    m_data[5*n + irow] = depo->extent_long();
+    m_data[6*n + irow] = depo->extent_tran();
+    m_info[0*n + irow] = depo->id();
+    m_info[1*n + irow] = depo->pdg();
+    m_info[2*n + irow] = gen;
+    m_info[3*n + irow] = childid;
+    m_info[4*n + irow] = priorid;
 }
 
+// Amend a row saved earlier, if it is still in the buffers, to be a
+// received depo (gen 0) or, if it has none, to have the given child.
+void Sio::NumpyDepoSaver::amend_row(size_t row, bool received, size_t childid)
+{
+    if (row < m_nflushed) {     // already written
+        return;
+    }
+    const size_t irow = row - m_nflushed;
+    const size_t n = m_capacity;
+    if (received) {
+        m_info[2*n + irow] = 0;
+    }
+    else if (!m_info[3*n + irow]) {
+        m_info[3*n + irow] = childid;
+    }
+}
+
+// Save a received depo and walk its chain of priors, stopping at the
+// first one already saved.  Each depo, received or a prior, is saved
+// once.
+void Sio::NumpyDepoSaver::push_depo(WireCell::IDepo::pointer depo)
+{
+    auto it = m_visited.find(depo);
+    if (it != m_visited.end()) { // saved as the prior of an earlier depo
+        amend_row(it->second, true, 0);
+        return;
+    }
+    m_visited[depo] = m_nflushed + m_nrows;
+
+    size_t gen = 0, childid = 0;
+    while (depo) {
+        // Flushing does not change the row number of the next row.
+        const size_t row = m_nflushed + m_nrows;
+
+        auto prior = depo->prior();
+        size_t priorid = 0;
+        if (prior) {
+            auto pit = m_visited.find(prior);
+            if (pit == m_visited.end()) {
+                priorid = row + 2; // next row
+                m_visited[prior] = row + 1;
+            }
+            else {
+                priorid = pit->second + 1;
+                amend_row(pit->second, false, row + 1);
+                prior = nullptr;
+            }
+        }
 
-typedef std::tuple<IDepo::pointer, size_t, size_t> depo_gen_child;
-typedef std::vector< depo_gen_child > depos_with_prior;
+        push_row(depo, gen, childid, priorid);
+        depo = prior;
+        childid = row + 1;
+        ++gen;
+    }
+}
 
-static void push_depo(depos_with_prior& dp, WireCell::IDepo::pointer depo, size_t gen=0, size_t childid=0)
+// Compact a partly filled column-major buffer so its columns are
+// contiguous with nrows each.
+template<typename T>
+static void compact(std::vector<T>& buf, size_t ncols, size_t capacity, size_t nrows)
 {
-    dp.push_back(depo_gen_child(depo, gen, childid));
-    auto prior = depo->prior();
-    if (!prior) {
+    if (nrows == capacity) {
         return;
     }
-    push_depo(dp, prior, gen+1, dp.size());
+    for (size_t icol=1; icol<ncols; ++icol) {
+        std::copy(buf.begin() + icol*capacity, buf.begin() + icol*capacity + nrows,
+                  buf.begin() + icol*nrows);
+    }
 }
-static depos_with_prior flatten_depos(std::vector<WireCell::IDepo::pointer> depos)
+
+void Sio::NumpyDepoSaver::flush_rows()
 {
-    depos_with_prior ret;
-    for (auto depo : depos) {
-        push_depo(ret, depo);
+    const size_t nrows = m_nrows;
+    if (!nrows) {
+        return;
+    }
+    Metrics::Timer timer(m_metrics, "flush_s");
+    m_metrics.peak("peak_buffered_rows", m_capacity);
+    m_metrics.add("rows", nrows);
+    compact(m_data, ndata, m_capacity, nrows);
+    compact(m_info, ninfo, m_capacity, nrows);
+
+    std::string data_name = String::format("depo_data_%d", m_save_count);
+    std::string info_name = String::format("depo_info_%d", m_save_count);
+    if (m_chunk_size) {
+        data_name += String::format("_chunk%d", m_chunk_count);
+        info_name += String::format("_chunk%d", m_chunk_count);
+    }
+    ++m_chunk_count;
+
+    if (!m_npz.is_open()) {     // a new file or depos after an EOS
+        const std::string fname = m_roll.filename(m_save_count, m_save_count);
+        m_npz.open(fname, get(m_cfg, "queue_depth", 0), m_level);
+        if (m_indexed) {
+            m_index.open(fname, m_npz.appending());
+        }
+    }
+    m_npz.write(data_name, m_data.data(), {ndata, nrows});
+    m_npz.write(info_name, m_info.data(), {ninfo, nrows});
+    m_entries.push_back(data_name);
+    m_entries.push_back(info_name);
+
+    m_nflushed += nrows;
+    m_nrows = 0;
+    if (m_capacity != m_chunk_size) { // reuse chunk buffers
+        reserve(m_chunk_size);
     }
-    return ret;
 }
 
 
@@ -70,62 +254,93 @@ bool Sio::NumpyDepoSaver::operator()(const WireCell::IDepo::pointer& indepo,
                                  WireCell::IDepo::pointer& outdepo)
 {
     if (indepo) {
+        m_metrics.mark();
+        ++m_ndepos;
         outdepo = indepo;
-        m_depos.push_back(indepo);
+        if (m_chunk_size) {
+            push_depo(indepo);
+        }
+        else {
+            m_depos.push_back(indepo);
+        }
         return true;
     }
     outdepo = nullptr;
+    const size_t ndepos = m_ndepos;
+    m_metrics.add("depos", m_ndepos);
+    m_ndepos = 0;
 
-    const size_t ndepos = m_depos.size();
-    if (!ndepos) {
-        std::cerr << "NumpyDepoSaver: warning: EOS and no depos seen.\n";
+    if (!m_chunk_size) {
+        m_metrics.peak("peak_buffered_depos", m_depos.size());
+        // One row per distinct depo, received or a prior.
+        size_t nrows = 0;
+        std::unordered_set<const IDepo*> seen;
+        for (const auto& depo : m_depos) {
+            for (const IDepo* d = depo.get(); d; d = d->prior().get()) {
+                if (!seen.insert(d).second) {
+                    break;
+                }
+                ++nrows;
+            }
+        }
+        reserve(nrows);
+        for (const auto& depo : m_depos) {
+            push_depo(depo);
+        }
+        m_depos.clear();
+    }
+
+    if (!m_nflushed and !m_nrows) {
+        l->warn("NumpyDepoSaver: EOS and no depos seen");
+        m_metrics.eos();
         return true;
     }
         
-    auto fdepos = flatten_depos(m_depos);
-    const size_t nfdepos = fdepos.size();
-
-    // time, charge, x, y, z, dlong, dtran
-    const size_t ndata=7;
-    Array::array_xxf data(nfdepos, ndata);
-    // ID, pdg, gen, child
-    const size_t ninfo = 4;
-    Array::array_xxi info(nfdepos, ninfo);
-    for (size_t idepo=0; idepo != nfdepos; ++idepo) {
-        auto depogc = fdepos[idepo];
-        auto depo = std::get<0>(depogc);
-        auto gen = std::get<1>(depogc);
-        auto child = std::get<2>(depogc);
-        data(idepo, 0) = depo->time();
-        data(idepo, 1) = depo->charge();
-        data(idepo, 2) = depo->pos().x();
-        data(idepo, 3) = depo->pos().y();
-        data(idepo, 4) = depo->pos().z();
-        data(idepo, 5) = depo->extent_long();
-        data(idepo, 6) = depo->extent_tran();
-        info(idepo, 0) = depo->id();
-        info(idepo, 1) = depo->pdg();
-        info(idepo, 2) = gen;
-        info(idepo, 3) = child;
-    }
-    const std::string data_name = String::format("depo_data_%d", m_save_count);
-    const std::string info_name = String::format("depo_info_%d", m_save_count);
-
-    const std::string fname = m_cfg["filename"].asString();
-    const std::string mode = "a";
-    cnpy::npz_save(fname, data_name, data.data(), {ndata, ndepos}, mode);
-    cnpy::npz_save(fname, info_name, info.data(), {ninfo, ndepos}, mode);
-    m_depos.clear();
+    flush_rows();
+    if (m_indexed) {
+        Configuration jsave;
+        jsave["count"] = m_save_count;
+        jsave["depos"] = (Json::UInt64)ndepos;
+        jsave["rows"] = (Json::UInt64)m_nflushed;
+        jsave["entries"] = Json::arrayValue;
+        for (const auto& name : m_entries) {
+            jsave["entries"].append(name);
+        }
+        m_index.add_save(jsave);
+    }
+    m_entries.clear();
+    {
+        Metrics::Timer timer(m_metrics, "close_s");
+        close_file();
+    }
+    add_stats(m_metrics, m_npz.take_stats());
+    m_metrics.eos();
+    if (m_roll.saved(m_npz.size())) { // closed, so all entries counted
+        m_roll.next();
+    }
 
+    m_nflushed = 0;
+    m_chunk_count = 0;
+    m_visited.clear();
     ++m_save_count;
     return true;
 }
 
+void Sio::NumpyDepoSaver::close_file()
+{
+    if (!m_npz.is_open()) {
+        return;
+    }
+    m_npz.close();
+    if (m_indexed) {
+        m_index.add_entries(m_npz.take_entries());
+        m_index.write();
+    }
+}
 
-
-
-
-
-
-
-
+void Sio::NumpyDepoSaver::finalize()
+{
+    close_file();
+    add_stats(m_metrics, m_npz.take_stats());
+    m_metrics.finalize();
+}
@@ -2,23 +2,394 @@
 
 #include "WireCellIface/FrameTools.h"
 #include "WireCellUtil/NamedFactory.h"
-#include "WireCellUtil/cnpy.h"
+#include "WireCellUtil/Exceptions.h"
 
 #include <string>
 #include <vector>
 #include <algorithm>
 #include <tuple>
 #include <sstream>
+#include <future>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
 
 WIRECELL_FACTORY(NumpyFrameSaver, WireCell::Sio::NumpyFrameSaver,
-                 WireCell::IFrameFilter, WireCell::IConfigurable)
+                 WireCell::IFrameFilter, WireCell::IConfigurable, WireCell::ITerminal)
 
 using namespace WireCell;
 
+namespace {
+
+    // How the samples of each tag are made and saved.
+    struct SaveOptions {
+        float baseline, scale, offset;
+        std::string dtype;      // float32, int16, uint16 or uint12
+        bool sparse;
+        // Inclusive channel ranges, sorted, empty to save all.
+        std::vector< std::pair<int,int> > channels;
+        // Window of tbins [lo, hi) if windowed.
+        bool windowed;
+        int tbin_lo, tbin_hi;
+        int level;              // compression, see NpzWriter::open()
+        int count;              // the save count N of entry names
+
+        bool keep(const ITrace::pointer& trace) const {
+            if (windowed) {
+                const int tbin = trace->tbin();
+                if (tbin >= tbin_hi or tbin + (int)trace->charge().size() <= tbin_lo) {
+                    return false;
+                }
+            }
+            if (channels.empty()) {
+                return true;
+            }
+            const int ch = trace->channel();
+            auto it = std::upper_bound(channels.begin(), channels.end(),
+                                       std::make_pair(ch, std::numeric_limits<int>::max()));
+            return it != channels.begin() and ch <= (--it)->second;
+        }
+    };
+
+    // Convert a sample value to that of the saved dtype.  Integer
+    // types round to nearest and saturate at their limits, counting
+    // the samples that are clipped.
+    struct Quantizer {
+        bool integer;
+        float lo, hi;
+        size_t nclipped;
+
+        explicit Quantizer(const std::string& dtype)
+            : integer(dtype != "float32"), lo(0), hi(0), nclipped(0) {
+            if (dtype == "int16") {
+                lo = std::numeric_limits<int16_t>::lowest();
+                hi = std::numeric_limits<int16_t>::max();
+            }
+            else if (dtype == "uint16") {
+                hi = std::numeric_limits<uint16_t>::max();
+            }
+            else if (dtype == "uint12") {
+                hi = 4095;
+            }
+        }
+
+        float operator()(float val) {
+            if (!integer) {
+                return val;
+            }
+            const float rounded = std::round(val);
+            if (!(rounded >= lo)) { // or NaN
+                ++nclipped;
+                return lo;
+            }
+            if (rounded > hi) {
+                ++nclipped;
+                return hi;
+            }
+            return rounded;
+        }
+    };
+
+    // Pack 12 bit values in pairs into three bytes, the first value
+    // in the low bits.  An odd count is padded with a zero value.
+    size_t packed12_size(size_t nvals)
+    {
+        return 3*((nvals+1)/2);
+    }
+    void pack12(const uint16_t* vals, size_t nvals, uint8_t* out)
+    {
+        for (size_t ind=0; ind<nvals; ind += 2) {
+            const uint16_t first = vals[ind];
+            const uint16_t second = ind+1 < nvals ? vals[ind+1] : 0;
+            *out++ = first & 0xff;
+            *out++ = (first >> 8) | ((second & 0xf) << 4);
+            *out++ = second >> 4;
+        }
+    }
+
+    // Fill the (nrows, ncols) column-major output in one pass.  Each
+    // channel row is summed in a scratch row, starting from the
+    // baseline, and then scaled, offset and quantized as it is
+    // stored.  Return the sum of the samples before quantizing.
+    template<typename T>
+    double fill_frame(T* out, const ITrace::vector& traces,
+                      const FrameTools::channel_list& channels,
+                      int tbin0, size_t ncols,
+                      const SaveOptions& opt, Quantizer& quant)
+    {
+        const size_t nrows = channels.size();
+
+        // Trace indices grouped by row, in trace order within a row.
+        std::vector< std::pair<size_t, size_t> > order; // (row, trace)
+        order.reserve(traces.size());
+        for (size_t itr=0; itr<traces.size(); ++itr) {
+            const int ch = traces[itr]->channel();
+            auto it = std::lower_bound(channels.begin(), channels.end(), ch);
+            order.emplace_back(it - channels.begin(), itr);
+        }
+        std::sort(order.begin(), order.end());
+
+        double qtot = 0;
+        std::vector<float> row(ncols);
+        for (size_t ind=0; ind<order.size(); ) {
+            const size_t irow = order[ind].first;
+            std::fill(row.begin(), row.end(), opt.baseline);
+            for (; ind<order.size() and order[ind].first == irow; ++ind) {
+                const auto& trace = traces[order[ind].second];
+                const auto& charge = trace->charge();
+                const int beg = trace->tbin() - tbin0;
+                const int lo = std::max(0, -beg);
+                const int hi = std::min((int)charge.size(), (int)ncols - beg);
+                for (int iq=lo; iq<hi; ++iq) {
+                    row[beg+iq] += charge[iq];
+                }
+            }
+            T* col = out + irow;
+            for (size_t icol=0; icol<ncols; ++icol) {
+                const float val = row[icol] * opt.scale + opt.offset;
+                qtot += val;
+                col[icol*nrows] = static_cast<T>(quant(val));
+            }
+        }
+        return qtot;
+    }
+
+    // Find the runs of ticks where some trace of a row has a nonzero
+    // sample and append their samples, valued as fill_frame() would,
+    // to the ragged arrays.  Runs are in channel then tick order.
+    // Return the sum of the samples before quantizing.
+    template<typename T>
+    double fill_sparse(std::vector<T>& samples, std::vector<int>& run_chans,
+                       std::vector<int>& run_tbins, std::vector<int>& run_offsets,
+                       const ITrace::vector& traces,
+                       const SaveOptions& opt, Quantizer& quant)
+    {
+        // Trace indices grouped by channel, in trace order.
+        std::vector< std::pair<int, size_t> > order; // (channel, trace)
+        order.reserve(traces.size());
+        for (size_t itr=0; itr<traces.size(); ++itr) {
+            order.emplace_back(traces[itr]->channel(), itr);
+        }
+        std::sort(order.begin(), order.end());
+
+        double qtot = 0;
+        std::vector<float> row;
+        std::vector<char> hit;
+        for (size_t ind=0; ind<order.size(); ) {
+            const int ch = order[ind].first;
+            size_t end = ind;
+            int lo = std::numeric_limits<int>::max(), hi = std::numeric_limits<int>::min();
+            for (; end<order.size() and order[end].first == ch; ++end) {
+                const auto& trace = traces[order[end].second];
+                lo = std::min(lo, trace->tbin());
+                hi = std::max(hi, trace->tbin() + (int)trace->charge().size());
+            }
+            if (opt.windowed) {
+                lo = std::max(lo, opt.tbin_lo);
+                hi = std::min(hi, opt.tbin_hi);
+            }
+            if (hi <= lo) {
+                ind = end;
+                continue;
+            }
+            row.assign(hi-lo, opt.baseline);
+            hit.assign(hi-lo, 0);
+            for (; ind<end; ++ind) {
+                const auto& trace = traces[order[ind].second];
+                const auto& charge = trace->charge();
+                const int beg = trace->tbin() - lo;
+                const int qlo = std::max(0, -beg);
+                const int qhi = std::min((int)charge.size(), hi - lo - beg);
+                for (int iq=qlo; iq<qhi; ++iq) {
+                    row[beg+iq] += charge[iq];
+                    hit[beg+iq] |= (charge[iq] != 0);
+                }
+            }
+            for (int itick=0; itick < hi-lo; ) {
+                if (!hit[itick]) {
+                    ++itick;
+                    continue;
+                }
+                run_chans.push_back(ch);
+                run_tbins.push_back(lo + itick);
+                run_offsets.push_back(samples.size());
+                for (; itick < hi-lo and hit[itick]; ++itick) {
+                    const float val = row[itick] * opt.scale + opt.offset;
+                    qtot += val;
+                    samples.push_back(static_cast<T>(quant(val)));
+                }
+            }
+        }
+        run_offsets.push_back(samples.size());
+        return qtot;
+    }
+
+    // The arrays saved for one tag of one frame.
+    struct TagArrays {
+        std::string tag;
+        size_t ntraces;
+        size_t nchannels;
+        size_t ncols;
+        size_t nruns;
+        double qtot;
+        size_t nsamples;
+        size_t nclipped;
+        double fill_s;          // seconds to select, fill and compress
+        // The entries to write, in order.  The dense frame or, if
+        // sparse, the samples and their runs, then the channels and
+        // the tickinfo.
+        std::vector<Sio::NpzWriter::Prepared> entries;
+    };
+
+    // Make entry <what>_<tag>_N of the array, compressed as
+    // configured.  A stored entry keeps the array, not a copy.
+    template<typename T>
+    void add_entry(TagArrays& ta, const SaveOptions& opt, const char* what,
+                   std::shared_ptr<const T> data, const std::vector<size_t>& shape)
+    {
+        const std::string name = String::format("%s_%s_%d", what, ta.tag.c_str(), opt.count);
+        ta.entries.push_back(Sio::NpzWriter::prepare(name, data, shape, opt.level));
+    }
+    template<typename T>
+    void add_entry(TagArrays& ta, const SaveOptions& opt, const char* what,
+                   std::vector<T>&& vec, const std::vector<size_t>& shape)
+    {
+        auto owner = std::make_shared< std::vector<T> >(std::move(vec));
+        add_entry(ta, opt, what, std::shared_ptr<const T>(owner, owner->data()), shape);
+    }
+
+    // Fill the tag's samples as type T.  Either are left as is or,
+    // if packed, T is uint16_t and they are packed 12 bits each.
+    template<typename T>
+    void fill_samples(TagArrays& ta, const ITrace::vector& traces,
+                      const FrameTools::channel_list& channels, int tbin,
+                      const SaveOptions& opt, bool packed)
+    {
+        Quantizer quant(opt.dtype);
+        const size_t nrows = channels.size();
+        const size_t ncols = ta.ncols;
+
+        if (opt.sparse) {
+            std::vector<T> samples;
+            std::vector<int> run_chans, run_tbins, run_offsets;
+            ta.qtot = fill_sparse(samples, run_chans, run_tbins, run_offsets,
+                                  traces, opt, quant);
+            const size_t nvals = samples.size();
+            ta.nsamples = nvals;
+            ta.nclipped = quant.nclipped;
+            ta.nruns = run_chans.size();
+            if (packed) {
+                std::vector<uint8_t> bytes(packed12_size(nvals));
+                pack12((const uint16_t*)samples.data(), nvals, bytes.data());
+                samples = std::vector<T>();
+                add_entry(ta, opt, "samples", std::move(bytes), {packed12_size(nvals)});
+            }
+            else {
+                add_entry(ta, opt, "samples", std::move(samples), {nvals});
+            }
+            add_entry(ta, opt, "trace_channels", std::move(run_chans), {ta.nruns});
+            add_entry(ta, opt, "trace_tbins", std::move(run_tbins), {ta.nruns});
+            add_entry(ta, opt, "trace_offsets", std::move(run_offsets), {ta.nruns+1});
+            return;
+        }
+
+        // Every element is set by fill_frame() so leave uninitialized.
+        std::shared_ptr<T> data(new T[nrows*ncols], std::default_delete<T[]>());
+        ta.qtot = fill_frame(data.get(), traces, channels, tbin, ncols, opt, quant);
+        ta.nsamples = nrows*ncols;
+        ta.nclipped = quant.nclipped;
+        if (packed) {           // each tick's row of channels padded to whole bytes
+            const size_t rowbytes = packed12_size(nrows);
+            std::vector<uint8_t> bytes(ncols*rowbytes);
+            for (size_t icol=0; icol<ncols; ++icol) {
+                pack12((const uint16_t*)data.get() + icol*nrows, nrows, bytes.data() + icol*rowbytes);
+            }
+            data.reset();
+            add_entry(ta, opt, "frame", std::move(bytes), {ncols, rowbytes});
+        }
+        else {
+            add_entry(ta, opt, "frame", std::shared_ptr<const T>(data), {ncols, nrows});
+        }
+    }
+
+    // Select, fill and compress all arrays of a tag.
+    TagArrays build_tag(IFrame::pointer frame, std::string tag, SaveOptions opt)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        TagArrays ta{tag, 0, 0, 0, 0, 0, 0, 0, 0, {}};
+        auto traces = FrameTools::tagged_traces(frame, tag);
+        if (opt.windowed or !opt.channels.empty()) {
+            // Select before anything is allocated for the frame.
+            ITrace::vector selected;
+            for (const auto& trace : traces) {
+                if (opt.keep(trace)) {
+                    selected.push_back(trace);
+                }
+            }
+            traces.swap(selected);
+        }
+        ta.ntraces = traces.size();
+        if (traces.empty()) {
+            return ta;
+        }
+        auto channels = FrameTools::channels(traces);
+        std::sort(channels.begin(), channels.end());
+        channels.erase(std::unique(channels.begin(), channels.end()), channels.end());
+        ta.nchannels = channels.size();
+        int tbin = 0;
+        if (opt.windowed) {
+            tbin = opt.tbin_lo;
+            ta.ncols = opt.tbin_hi - opt.tbin_lo;
+        }
+        else {
+            auto tbinmm = FrameTools::tbin_range(traces);
+            tbin = tbinmm.first;
+            ta.ncols = tbinmm.second-tbinmm.first;
+        }
+
+        if (opt.dtype == "float32") {
+            fill_samples<float>(ta, traces, channels, tbin, opt, false);
+        }
+        else if (opt.dtype == "int16") {
+            fill_samples<int16_t>(ta, traces, channels, tbin, opt, false);
+        }
+        else if (opt.dtype == "uint16") {
+            fill_samples<uint16_t>(ta, traces, channels, tbin, opt, false);
+        }
+        else {                  // uint12
+            fill_samples<uint16_t>(ta, traces, channels, tbin, opt, true);
+        }
+
+        const size_t nchannels = channels.size();
+        add_entry(ta, opt, "channels", std::move(channels), {nchannels});
+
+        std::vector<double> tickinfo{frame->time(), frame->tick(), (double)tbin};
+        if (opt.sparse) {       // what fills the dense frame outside runs
+            Quantizer quant(opt.dtype);
+            tickinfo.push_back(ta.ncols);
+            tickinfo.push_back(quant(opt.baseline * opt.scale + opt.offset));
+        }
+        const size_t ninfo = tickinfo.size();
+        add_entry(ta, opt, "tickinfo", std::move(tickinfo), {ninfo});
+
+        ta.fill_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return ta;
+    }
+}
+
 Sio::NumpyFrameSaver::NumpyFrameSaver()
     : m_save_count(0)
+    , m_level(0)
+    , m_indexed(false)
+    , m_windowed(false)
+    , m_tick_window(0, 0)
+    , m_metrics("NumpyFrameSaver")
     , l(Log::logger("io"))
 {
+    m_metrics.rate("frames_per_s", "frames", "busy_s");
+    m_metrics.rate("bytes_out_per_s", "bytes_out", "busy_s");
 }
 
 Sio::NumpyFrameSaver::~NumpyFrameSaver()
@@ -30,8 +401,13 @@ WireCell::Configuration Sio::NumpyFrameSaver::default_configuration() const
 {
     Configuration cfg;
 
-    // If digitize is true, then samples as 16 bit ints.  Otherwise
-    // save as 32 bit floats.
+    // The type of the saved samples.  One of "float32", "int16",
+    // "uint16" or "uint12".  Integer samples are rounded to nearest
+    // and saturated at the type's limits, the number clipped being
+    // logged.  "uint12" packs pairs of samples in 3 bytes saved as a
+    // uint8 array, see NumpyFrameSaver.h.  If empty, the dtype is
+    // int16 if digitize is true and otherwise float32.
+    cfg["dtype"] = "";
     cfg["digitize"] = false;
 
     // This number is set to the waveform sample array before any
@@ -46,6 +422,15 @@ WireCell::Configuration Sio::NumpyFrameSaver::default_configuration() const
     // casting to dtype.
     cfg["offset"] = 0.0;
 
+    // The channels to save as a list of channel numbers and [first,
+    // last] (inclusive) ranges.  If empty, all channels are saved.
+    cfg["channels"] = Json::arrayValue;
+
+    // The window of ticks to save as [first, end) tbins.  The dense
+    // frame then always spans this window.  If empty, the range of
+    // the traces of each tag is saved.
+    cfg["tick_window"] = Json::arrayValue;
+
     // The frame tags to consider for saving.  If null or empty then all traces are used.
     cfg["frame_tags"] = Json::arrayValue;
     // The summary tags to consider for saving
@@ -56,8 +441,43 @@ WireCell::Configuration Sio::NumpyFrameSaver::default_configuration() const
     // The output file name to write.  Only compressed (zipped) Numpy
     // files are supported.  Writing is always in "append" mode.  It's
     // up to the user to delete a previous instance of the file if
-    // it's old contents are not wanted.
+    // it's old contents are not wanted.  The file is held open and
+    // its zip directory is only written at EOS (or destruction).
+    // The name may hold {count}, {ident} and {part} to write
+    // several files, see Rollover.h.
     cfg["filename"] = "wct-frame.npz";
+
+    // Once a file holds this many saves or this many bytes it is
+    // closed and the next save starts a new file.  Zero for no limit.
+    cfg["max_saves"] = 0;
+    cfg["max_bytes"] = 0;
+
+    // If true, each file is accompanied by an index of its saves and
+    // where their arrays are in the file, see NpzIndex.h.
+    cfg["index"] = false;
+
+    // If nonzero, arrays are written by a separate I/O thread and
+    // this many may be queued for writing.  EOS waits for the queue
+    // to drain.  Zero writes synchronously.
+    cfg["queue_depth"] = 0;
+
+    // How array entries are compressed.  "store" writes them as is,
+    // as cnpy does.  "deflate" compresses them at the zlib "level",
+    // 1 (fastest) to 9 (smallest), as numpy.savez_compressed does.
+    cfg["codec"] = "store";
+    cfg["level"] = 1;
+
+    // If true, instead of the dense frame_<tag>_N array save only
+    // runs of ticks where some trace has a nonzero sample.  See
+    // NumpyFrameSaver.h for the arrays.
+    cfg["sparse"] = false;
+
+    // If true, the arrays for each tag are built and compressed
+    // concurrently, one thread per tag of each frame.  The arrays
+    // of all tags of a frame are then held at once, rather than
+    // those of one tag.  They are written in frame_tags order
+    // either way.
+    cfg["parallel"] = false;
         
     return cfg;
 }
@@ -65,6 +485,65 @@ WireCell::Configuration Sio::NumpyFrameSaver::default_configuration() const
 void Sio::NumpyFrameSaver::configure(const WireCell::Configuration& config)
 {
     m_cfg = config;
+    if (get(m_cfg, "queue_depth", 0) < 0) {
+        THROW(ValueError() << errmsg{"NumpyFrameSaver: queue_depth must not be negative"});
+    }
+    m_level = NpzWriter::codec_level(get<std::string>(m_cfg, "codec", "store"),
+                                     get(m_cfg, "level", 1));
+    m_roll.configure(m_cfg);
+    m_indexed = get(m_cfg, "index", false);
+    if (m_roll.fixed()) {
+        m_npz.open(m_roll.filename(0, 0), get(m_cfg, "queue_depth", 0), m_level);
+        if (m_indexed) {
+            m_index.open(m_npz.filename(), m_npz.appending());
+        }
+    }
+    else {                      // named by its first frame
+        close_file();
+    }
+
+    m_dtype = get<std::string>(m_cfg, "dtype", "");
+    if (m_dtype.empty()) {
+        m_dtype = get(m_cfg, "digitize", false) ? "int16" : "float32";
+    }
+    if (m_dtype != "float32" and m_dtype != "int16"
+        and m_dtype != "uint16" and m_dtype != "uint12") {
+        THROW(ValueError() << errmsg{"NumpyFrameSaver: unsupported dtype: " + m_dtype});
+    }
+
+    m_channels.clear();
+    for (auto jch : m_cfg["channels"]) {
+        if (jch.isArray()) {
+            if (jch.size() != 2 or jch[0].asInt() > jch[1].asInt()) {
+                THROW(ValueError() << errmsg{"NumpyFrameSaver: channel ranges must be [first, last]"});
+            }
+            m_channels.emplace_back(jch[0].asInt(), jch[1].asInt());
+        }
+        else {
+            m_channels.emplace_back(jch.asInt(), jch.asInt());
+        }
+    }
+    // Sort and merge overlaps so a channel is in at most one range.
+    std::sort(m_channels.begin(), m_channels.end());
+    std::vector< std::pair<int,int> > merged;
+    for (const auto& range : m_channels) {
+        if (!merged.empty() and range.first <= merged.back().second + 1) {
+            merged.back().second = std::max(merged.back().second, range.second);
+        }
+        else {
+            merged.push_back(range);
+        }
+    }
+    m_channels.swap(merged);
+
+    auto jwin = m_cfg["tick_window"];
+    m_windowed = !jwin.isNull() and jwin.size() > 0;
+    if (m_windowed) {
+        if (jwin.size() != 2 or jwin[0].asInt() >= jwin[1].asInt()) {
+            THROW(ValueError() << errmsg{"NumpyFrameSaver: tick_window must be [first, end)"});
+        }
+        m_tick_window = std::make_pair(jwin[0].asInt(), jwin[1].asInt());
+    }
 }
 
 
@@ -73,20 +552,46 @@ bool Sio::NumpyFrameSaver::operator()(const IFrame::pointer& inframe,
 {
     if (!inframe) {
         l->debug("NumpyFrameSaver: EOS");
+        {
+            Metrics::Timer timer(m_metrics, "busy_s");
+            close_file();
+        }
+        add_stats(m_metrics, m_npz.take_stats());
+        m_metrics.eos();
         outframe = nullptr;
         return true;
     }
+    Metrics::Timer timer(m_metrics, "busy_s");
+    m_metrics.mark();
     
     outframe = inframe;         // pass through actual frame
 
-    const std::string mode = "a";
-
-    const float baseline = m_cfg["baseline"].asFloat();
-    const float scale = m_cfg["scale"].asFloat();
-    const float offset = m_cfg["offset"].asFloat();
-    const bool digitize = m_cfg["digitize"].asBool();
+    const SaveOptions opt{m_cfg["baseline"].asFloat(),
+                          m_cfg["scale"].asFloat(),
+                          m_cfg["offset"].asFloat(),
+                          m_dtype,
+                          get(m_cfg, "sparse", false),
+                          m_channels,
+                          m_windowed, m_tick_window.first, m_tick_window.second,
+                          m_level, m_save_count};
+    const bool sparse = opt.sparse;
+
+    if (!m_npz.is_open()) {     // a new file or frames after an EOS
+        const std::string fname = m_roll.filename(m_save_count, inframe->ident());
+        m_npz.open(fname, get(m_cfg, "queue_depth", 0), m_level);
+        if (m_indexed) {
+            m_index.open(fname, m_npz.appending());
+        }
+    }
 
-    const std::string fname = m_cfg["filename"].asString();
+    // What the index records of this save.
+    Configuration jsave;
+    jsave["count"] = m_save_count;
+    jsave["ident"] = inframe->ident();
+    jsave["time"] = inframe->time();
+    jsave["tick"] = inframe->tick();
+    jsave["tags"] = Json::arrayValue;
+    jsave["entries"] = Json::arrayValue;
 
     // Eigen3 array is indexed as (irow, icol) or (ichan, itick)
     // one row is one channel, one column is a tick.
@@ -115,55 +620,82 @@ bool Sio::NumpyFrameSaver::operator()(const IFrame::pointer& inframe,
     l->debug(ss.str());
 
 
+    // Build and compress each tag's arrays as its own task, then
+    // write them in tag order so the archive does not depend on task
+    // timing.
+    const auto policy = get(m_cfg, "parallel", false)
+        ? std::launch::async : std::launch::deferred;
+    std::vector< std::future<TagArrays> > tasks;
     for (auto jtag : m_cfg["frame_tags"]) {
-        const std::string tag = jtag.asString();
-        auto traces = FrameTools::tagged_traces(inframe, tag);
-        l->debug("NumpyFrameSaver: save {} tagged as {}", traces.size(), tag);
-        if (traces.empty()) {
+        tasks.push_back(std::async(policy, build_tag, inframe, jtag.asString(), opt));
+    }
+
+    for (auto& task : tasks) {
+        TagArrays ta;
+        {
+            Metrics::Timer timer(m_metrics, "fill_wait_s");
+            ta = task.get();
+        }
+        m_metrics.add("fill_s", ta.fill_s);
+        m_metrics.add("traces", ta.ntraces);
+        m_metrics.add("samples", ta.nsamples);
+        m_metrics.add("clipped", ta.nclipped);
+        const std::string& tag = ta.tag;
+        l->debug("NumpyFrameSaver: save {} tagged as {}", ta.ntraces, tag);
+        if (!ta.ntraces) {
             l->warn("NumpyFrameSaver: no traces for tag: \"{}\"", tag);
             continue;
         }
-        auto channels = FrameTools::channels(traces);
-        std::sort(channels.begin(), channels.end());
-        auto chbeg = channels.begin();
-        auto chend = std::unique(chbeg, channels.end());
-        auto tbinmm = FrameTools::tbin_range(traces);
-
-        // fixme: may want to give user some config over tbin range to save.
-        const size_t ncols = tbinmm.second-tbinmm.first;
-        const size_t nrows = std::distance(chbeg, chend);
-        l->debug("NumpyFrameSaver: saving ncols={} nrows={}", ncols, nrows);
-
-        Array::array_xxf arr = Array::array_xxf::Zero(nrows, ncols) + baseline;
-        FrameTools::fill(arr, traces, channels.begin(), chend, tbinmm.first);
-        arr = arr * scale + offset;
-
-        {                   // the 2D frame array
-            const std::string aname = String::format("frame_%s_%d", tag.c_str(), m_save_count);
-            if (digitize) {
-                Array::array_xxs sarr = arr.cast<short>();
-                const short* sdata = sarr.data();
-                cnpy::npz_save(fname, aname, sdata, {ncols, nrows}, mode);
-            }
-            else {
-                cnpy::npz_save(fname, aname, arr.data(), {ncols, nrows}, mode);
-            }
-            l->debug("NumpyFrameSaver: saved {} with {} channels {} ticks @t={} ms qtot={}",
-                     aname, nrows, ncols, inframe->time() / units::ms, arr.sum());
-        }
 
-        {                   // the channel array
-            const std::string aname = String::format("channels_%s_%d", tag.c_str(), m_save_count);
-            cnpy::npz_save(fname, aname, channels.data(), {nrows}, mode);
+        jsave["tags"].append(tag);
+        const std::string aname = ta.entries.front().name;
+        for (auto& entry : ta.entries) {
+            jsave["entries"].append(entry.name);
+            m_npz.write(std::move(entry));
+        }
+        if (sparse) {
+            l->debug("NumpyFrameSaver: saved {} with {} runs {} samples @t={} ms qtot={}",
+                     aname, ta.nruns, ta.nsamples, inframe->time() / units::ms, ta.qtot);
+        }
+        else {
+            l->debug("NumpyFrameSaver: saved {} with {} channels {} ticks @t={} ms qtot={}",
+                     aname, ta.nchannels, ta.ncols, inframe->time() / units::ms, ta.qtot);
         }
 
-        {                   // the tick array
-            const std::string aname = String::format("tickinfo_%s_%d", tag.c_str(), m_save_count);
-            const std::vector<double> tickinfo{inframe->time(), inframe->tick(), (double)tbinmm.first};
-            cnpy::npz_save(fname, aname, tickinfo.data(), {3}, mode);
+        if (ta.nclipped) {
+            l->warn("NumpyFrameSaver: frame #{} tag \"{}\": clipped {} of {} samples to {}",
+                    inframe->ident(), tag, ta.nclipped, ta.nsamples, m_dtype);
         }
     }
 
+    if (m_indexed) {
+        m_index.add_save(jsave);
+    }
     ++m_save_count;
+    m_metrics.add("frames", 1);
+    // Only a byte limit needs the size, which waits for the queue.
+    if (m_roll.saved(m_roll.max_bytes() ? m_npz.size() : 0)) {
+        close_file();
+        m_roll.next();
+    }
     return true;
 }
+
+void Sio::NumpyFrameSaver::close_file()
+{
+    if (!m_npz.is_open()) {
+        return;
+    }
+    m_npz.close();
+    if (m_indexed) {
+        m_index.add_entries(m_npz.take_entries());
+        m_index.write();
+    }
+}
+
+void Sio::NumpyFrameSaver::finalize()
+{
+    close_file();
+    add_stats(m_metrics, m_npz.take_stats());
+    m_metrics.finalize();
+}
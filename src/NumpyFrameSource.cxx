@@ -0,0 +1,346 @@
+#include "WireCellSio/NumpyFrameSource.h"
+#include "WireCellSio/NpzReader.h"
+#include "WireCellSio/NpzIndex.h"
+
+#include "WireCellIface/SimpleFrame.h"
+#include "WireCellIface/SimpleTrace.h"
+#include "WireCellUtil/NamedFactory.h"
+#include "WireCellUtil/Exceptions.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+WIRECELL_FACTORY(NumpyFrameSource, WireCell::Sio::NumpyFrameSource,
+                 WireCell::IFrameSource, WireCell::IConfigurable, WireCell::ITerminal)
+
+using namespace WireCell;
+
+Sio::NumpyFrameSource::NumpyFrameSource()
+    : m_dense(false)
+    , m_eos(false)
+    , m_metrics("NumpyFrameSource")
+    , l(Log::logger("io"))
+{
+    m_metrics.rate("frames_per_s", "frames", "span_s");
+    m_metrics.rate("decode_frames_per_s", "frames", "decode_s");
+}
+
+Sio::NumpyFrameSource::~NumpyFrameSource()
+{
+}
+
+WireCell::Configuration Sio::NumpyFrameSource::default_configuration() const
+{
+    Configuration cfg;
+
+    // The input file as written by NumpyFrameSaver.
+    cfg["filename"] = "wct-frame.npz";
+
+    // The tags to load.  If null or empty then all saved tags are
+    // loaded.  The untagged traces are saved with tag "".
+    cfg["frame_tags"] = Json::arrayValue;
+
+    // Tags saved in sparse mode give one trace per run of samples.
+    // If true, instead give one trace per channel spanning all ticks
+    // of the original frame, as for a dense save.
+    cfg["dense"] = false;
+
+    return cfg;
+}
+
+void Sio::NumpyFrameSource::configure(const WireCell::Configuration& cfg)
+{
+    m_reader.reset(new NpzReader(get<std::string>(cfg, "filename")));
+    m_saves.clear();
+    m_eos = false;
+    m_dense = get(cfg, "dense", false);
+
+    std::vector<std::string> want;
+    for (auto jtag : cfg["frame_tags"]) {
+        want.push_back(jtag.asString());
+    }
+
+    // Names are frame_<tag>_<N>, or samples_<tag>_<N> if saved
+    // sparse, where the tag itself may hold "_".
+    for (const auto& name : m_reader->names()) {
+        std::string prefix = "frame_";
+        if (name.compare(0, prefix.size(), prefix) != 0) {
+            prefix = "samples_";
+            if (name.compare(0, prefix.size(), prefix) != 0) {
+                continue;
+            }
+        }
+        const size_t under = name.rfind('_');
+        if (under < prefix.size()) {
+            continue;
+        }
+        const std::string tag = name.substr(prefix.size(), under - prefix.size());
+        const std::string num = name.substr(under+1);
+        if (num.empty() or num.find_first_not_of("0123456789") != std::string::npos) {
+            continue;
+        }
+        if (!want.empty() and std::find(want.begin(), want.end(), tag) == want.end()) {
+            continue;
+        }
+        m_saves[std::stoi(num)].push_back(tag);
+    }
+    l->debug("NumpyFrameSource: found {} frames in {}", m_saves.size(), m_reader->filename());
+
+    // The saved frame idents, if the file has an index.
+    m_idents.clear();
+    const auto jindex = NpzIndex::load(m_reader->filename());
+    for (const auto& jsave : jindex["saves"]) {
+        if (jsave.isMember("ident")) {
+            m_idents[jsave["count"].asInt()] = jsave["ident"].asInt();
+        }
+    }
+}
+
+bool Sio::NumpyFrameSource::operator()(IFrame::pointer& out)
+{
+    out = nullptr;
+    if (m_eos) {
+        return false;
+    }
+    if (m_saves.empty()) {
+        m_eos = true;
+        m_metrics.eos();
+        return true;            // EOS
+    }
+    m_metrics.mark();
+    auto it = m_saves.begin();
+    {
+        Metrics::Timer timer(m_metrics, "decode_s");
+        out = load(it->first);
+    }
+    m_saves.erase(it);
+    m_metrics.add("frames", 1);
+    m_metrics.add("traces", out->traces()->size());
+    return true;
+}
+
+void Sio::NumpyFrameSource::finalize()
+{
+    m_metrics.finalize();
+}
+
+// Transpose the (ntick, nchan) array into one sample sequence per
+// channel.  The array is read once in storage order.
+template<typename T>
+static void fill_traces(const Sio::NpzReader::Array& arr, std::vector<SimpleTrace*>& traces)
+{
+    const size_t ncols = arr.shape[0], nrows = arr.shape[1];
+    size_t ind = 0;
+    for (size_t icol=0; icol<ncols; ++icol) {
+        for (size_t irow=0; irow<nrows; ++irow) {
+            traces[irow]->charge()[icol] = arr.value<T>(ind++);
+        }
+    }
+}
+
+// The ind'th of the 12 bit samples packed by NumpyFrameSaver in the
+// uint8 array from byte "base", two samples per three bytes.
+static float unpack12(const Sio::NpzReader::Array& arr, size_t base, size_t ind)
+{
+    const size_t byte = base + 3*(ind/2);
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(arr.data);
+    if (ind % 2) {
+        return (bytes[byte+1] >> 4) | (bytes[byte+2] << 4);
+    }
+    return bytes[byte] | ((bytes[byte+1] & 0xf) << 8);
+}
+static size_t packed12_size(size_t nvals)
+{
+    return 3*((nvals+1)/2);
+}
+
+static void fill_traces_packed12(const Sio::NpzReader::Array& arr, std::vector<SimpleTrace*>& traces)
+{
+    const size_t ncols = arr.shape[0], rowbytes = arr.shape[1], nrows = traces.size();
+    for (size_t icol=0; icol<ncols; ++icol) {
+        for (size_t irow=0; irow<nrows; ++irow) {
+            traces[irow]->charge()[icol] = unpack12(arr, icol*rowbytes, irow);
+        }
+    }
+}
+
+void Sio::NumpyFrameSource::load_dense(const std::string& name, const std::string& tag, int save,
+                                       const std::vector<double>& tickinfo,
+                                       ITrace::vector& all_traces, IFrame::trace_list_t& indices)
+{
+    const auto arr = m_reader->get(name);
+    const auto chans = m_reader->get(String::format("channels_%s_%d", tag.c_str(), save)).copy<int>();
+
+    const bool packed = arr.is_type<uint8_t>(); // uint12
+    const size_t width = packed ? packed12_size(chans.size()) : chans.size();
+    if (arr.shape.size() != 2 or arr.fortran_order
+        or arr.shape[1] != width or tickinfo.size() != 3) {
+        THROW(ValueError() << errmsg{"NumpyFrameSource: malformed arrays for " + arr.name});
+    }
+    const int tbin = tickinfo[2];
+    const size_t ncols = arr.shape[0], nrows = chans.size();
+
+    std::vector<SimpleTrace*> traces(nrows);
+    for (size_t irow=0; irow<nrows; ++irow) {
+        traces[irow] = new SimpleTrace(chans[irow], tbin, ncols);
+        indices.push_back(all_traces.size());
+        all_traces.push_back(ITrace::pointer(traces[irow]));
+    }
+    if (arr.is_type<float>()) {
+        fill_traces<float>(arr, traces);
+    }
+    else if (arr.is_type<short>()) {
+        fill_traces<short>(arr, traces);
+    }
+    else if (arr.is_type<uint16_t>()) {
+        fill_traces<uint16_t>(arr, traces);
+    }
+    else if (packed) {
+        fill_traces_packed12(arr, traces);
+    }
+    else {
+        THROW(ValueError() << errmsg{"NumpyFrameSource: unsupported dtype "
+                    + arr.descr + " for " + arr.name});
+    }
+    l->debug("NumpyFrameSource: loaded {} with {} channels {} ticks", arr.name, nrows, ncols);
+}
+
+// Copy samples [beg,end) of the array into the trace from the index.
+template<typename T>
+static void fill_run(const Sio::NpzReader::Array& arr, size_t beg, size_t end,
+                     SimpleTrace* trace, size_t index)
+{
+    auto& charge = trace->charge();
+    for (size_t ind=beg; ind<end; ++ind) {
+        charge[index++] = arr.value<T>(ind);
+    }
+}
+static void fill_run_packed12(const Sio::NpzReader::Array& arr, size_t beg, size_t end,
+                              SimpleTrace* trace, size_t index)
+{
+    auto& charge = trace->charge();
+    for (size_t ind=beg; ind<end; ++ind) {
+        charge[index++] = unpack12(arr, 0, ind);
+    }
+}
+
+void Sio::NumpyFrameSource::load_sparse(const std::string& tag, int save,
+                                        const std::vector<double>& tickinfo,
+                                        ITrace::vector& all_traces, IFrame::trace_list_t& indices)
+{
+    auto name = [&](const char* what) {
+        return String::format("%s_%s_%d", what, tag.c_str(), save);
+    };
+    const auto arr = m_reader->get(name("samples"));
+    const auto run_chans = m_reader->get(name("trace_channels")).copy<int>();
+    const auto run_tbins = m_reader->get(name("trace_tbins")).copy<int>();
+    const auto run_offsets = m_reader->get(name("trace_offsets")).copy<int>();
+    const size_t nruns = run_chans.size();
+    const bool packed = arr.is_type<uint8_t>(); // uint12
+    if (arr.shape.size() != 1 or tickinfo.size() != 5
+        or run_tbins.size() != nruns or run_offsets.size() != nruns+1
+        or (packed ? packed12_size(run_offsets.back()) : (size_t)run_offsets.back()) != arr.num_vals()) {
+        THROW(ValueError() << errmsg{"NumpyFrameSource: malformed arrays for " + arr.name});
+    }
+    if (!packed and !arr.is_type<float>() and !arr.is_type<short>() and !arr.is_type<uint16_t>()) {
+        THROW(ValueError() << errmsg{"NumpyFrameSource: unsupported dtype "
+                    + arr.descr + " for " + arr.name});
+    }
+    auto fill = [&](size_t irun, SimpleTrace* trace, size_t index) {
+        const size_t beg = run_offsets[irun], end = run_offsets[irun+1];
+        if (beg > end or end > (size_t)run_offsets.back()
+            or index + (end-beg) > trace->charge().size()) {
+            THROW(ValueError() << errmsg{"NumpyFrameSource: malformed runs for " + arr.name});
+        }
+        if (packed) {
+            fill_run_packed12(arr, beg, end, trace, index);
+        }
+        else if (arr.is_type<float>()) {
+            fill_run<float>(arr, beg, end, trace, index);
+        }
+        else if (arr.is_type<short>()) {
+            fill_run<short>(arr, beg, end, trace, index);
+        }
+        else {
+            fill_run<uint16_t>(arr, beg, end, trace, index);
+        }
+    };
+
+    if (!m_dense) {             // one trace per run
+        for (size_t irun=0; irun<nruns; ++irun) {
+            const int nsamples = run_offsets[irun+1] - run_offsets[irun];
+            auto trace = new SimpleTrace(run_chans[irun], run_tbins[irun], std::max(nsamples, 0));
+            fill(irun, trace, 0);
+            indices.push_back(all_traces.size());
+            all_traces.push_back(ITrace::pointer(trace));
+        }
+        l->debug("NumpyFrameSource: loaded {} with {} runs", arr.name, nruns);
+        return;
+    }
+
+    // One trace per channel, filled as the dense frame was.
+    const auto chans = m_reader->get(name("channels")).copy<int>();
+    const int tbin = tickinfo[2];
+    const size_t ncols = tickinfo[3];
+    const float background = tickinfo[4];
+    std::map<int, SimpleTrace*> traces;
+    for (int ch : chans) {
+        auto trace = new SimpleTrace(ch, tbin, ncols);
+        std::fill(trace->charge().begin(), trace->charge().end(), background);
+        traces[ch] = trace;
+        indices.push_back(all_traces.size());
+        all_traces.push_back(ITrace::pointer(trace));
+    }
+    for (size_t irun=0; irun<nruns; ++irun) {
+        auto it = traces.find(run_chans[irun]);
+        if (it == traces.end() or run_tbins[irun] < tbin) {
+            THROW(ValueError() << errmsg{"NumpyFrameSource: malformed runs for " + arr.name});
+        }
+        fill(irun, it->second, run_tbins[irun] - tbin);
+    }
+    l->debug("NumpyFrameSource: loaded {} as {} channels {} ticks", arr.name, chans.size(), ncols);
+}
+
+IFrame::pointer Sio::NumpyFrameSource::load(int save)
+{
+    ITrace::vector all_traces;
+    std::vector< std::pair<std::string, IFrame::trace_list_t> > tagged;
+    double time = 0, tick = 0.5*units::us;
+    bool have_tickinfo = false;
+
+    for (const auto& tag : m_saves[save]) {
+        const auto tickinfo = m_reader->get(String::format("tickinfo_%s_%d", tag.c_str(), save)).copy<double>();
+        if (tickinfo.size() < 3) {
+            THROW(ValueError() << errmsg{"NumpyFrameSource: malformed tickinfo for tag " + tag});
+        }
+        if (!have_tickinfo) {
+            time = tickinfo[0];
+            tick = tickinfo[1];
+            have_tickinfo = true;
+        }
+
+        IFrame::trace_list_t indices;
+        const std::string fname = String::format("frame_%s_%d", tag.c_str(), save);
+        if (m_reader->has(fname)) {
+            load_dense(fname, tag, save, tickinfo, all_traces, indices);
+        }
+        else {
+            load_sparse(tag, save, tickinfo, all_traces, indices);
+        }
+
+        if (!tag.empty()) {
+            tagged.push_back(std::make_pair(tag, indices));
+        }
+    }
+
+    auto it = m_idents.find(save);
+    const int ident = it == m_idents.end() ? save : it->second;
+    auto sframe = new SimpleFrame(ident, time, all_traces, tick);
+    for (const auto& tt : tagged) {
+        sframe->tag_traces(tt.first, tt.second);
+    }
+    return IFrame::pointer(sframe);
+}
@@ -0,0 +1,77 @@
+#include "WireCellSio/Rollover.h"
+
+#include "WireCellUtil/Exceptions.h"
+
+using namespace WireCell;
+
+Sio::Rollover::Rollover()
+    : m_fixed(true)
+    , m_max_saves(0)
+    , m_max_bytes(0)
+    , m_part(0)
+    , m_nsaves(0)
+{
+}
+
+static bool has(const std::string& str, const std::string& sub)
+{
+    return str.find(sub) != std::string::npos;
+}
+
+static void replace_all(std::string& str, const std::string& from, const std::string& to)
+{
+    for (size_t pos = str.find(from); pos != std::string::npos;
+         pos = str.find(from, pos + to.size())) {
+        str.replace(pos, from.size(), to);
+    }
+}
+
+void Sio::Rollover::configure(const Configuration& cfg)
+{
+    m_template = get<std::string>(cfg, "filename");
+    const int max_saves = get(cfg, "max_saves", 0);
+    const double max_bytes = get(cfg, "max_bytes", 0.0);
+    if (max_saves < 0 or max_bytes < 0) {
+        THROW(ValueError() << errmsg{"Rollover: max_saves and max_bytes must not be negative"});
+    }
+    m_max_saves = max_saves;
+    m_max_bytes = max_bytes;
+    const bool per_save = has(m_template, "{count}") or has(m_template, "{ident}");
+    m_fixed = !per_save and !has(m_template, "{part}");
+    if (m_fixed and (m_max_saves or m_max_bytes)) {
+        THROW(ValueError() << errmsg{"Rollover: max_saves or max_bytes needs {count}, {ident} or {part} in filename " + m_template});
+    }
+    if (per_save and !m_max_saves and !m_max_bytes) {
+        m_max_saves = 1;
+    }
+    m_current.clear();
+    m_part = 0;
+    m_nsaves = 0;
+}
+
+std::string Sio::Rollover::filename(int count, int ident)
+{
+    if (m_current.empty()) {
+        m_current = m_template;
+        replace_all(m_current, "{count}", std::to_string(count));
+        replace_all(m_current, "{ident}", std::to_string(ident));
+        replace_all(m_current, "{part}", std::to_string(m_part));
+    }
+    return m_current;
+}
+
+bool Sio::Rollover::saved(size_t size)
+{
+    ++m_nsaves;
+    if (m_max_saves and m_nsaves >= m_max_saves) {
+        return true;
+    }
+    return m_max_bytes and size >= m_max_bytes;
+}
+
+void Sio::Rollover::next()
+{
+    m_current.clear();
+    ++m_part;
+    m_nsaves = 0;
+}
@@ -0,0 +1,118 @@
+// Benchmark NpzWriter compression settings on a reference frame.
+//
+// A frame of nchan x ntick samples (default 2560 x 6000) of baseline
+// plus Gaussian noise plus a few signal pulses is written as int16
+// and as float32 with each codec setting.  For each, print the write
+// and read back rates in MB/s of array data and the compression
+// ratio (array bytes over file bytes).
+//
+//   check_npzcodec [nchan [ntick [nrepeat]]]
+
+#include "WireCellSio/NpzWriter.h"
+#include "WireCellSio/NpzReader.h"
+
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace WireCell;
+
+typedef std::chrono::steady_clock clock_type;
+
+static double seconds_since(clock_type::time_point start)
+{
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+static long file_size(const std::string& fname)
+{
+    FILE* fp = fopen(fname.c_str(), "rb");
+    assert(fp);
+    fseek(fp, 0, SEEK_END);
+    const long size = ftell(fp);
+    fclose(fp);
+    return size;
+}
+
+template<typename T>
+static void bench(const std::string& dtype, const std::vector<T>& frame,
+                  size_t nchan, size_t ntick, int nrepeat)
+{
+    const std::string fname = "check_npzcodec.npz";
+    const double mb = nrepeat * frame.size() * sizeof(T) / 1e6;
+
+    struct Setting { std::string codec; int level; };
+    const std::vector<Setting> settings{
+        {"store", 0}, {"deflate", 1}, {"deflate", 3}, {"deflate", 6}, {"deflate", 9}};
+    for (const auto& setting : settings) {
+        remove(fname.c_str());
+
+        auto start = clock_type::now();
+        {
+            Sio::NpzWriter npz;
+            npz.open(fname, 0, Sio::NpzWriter::codec_level(setting.codec, setting.level));
+            for (int count=0; count<nrepeat; ++count) {
+                npz.write("frame_" + std::to_string(count), frame.data(), {ntick, nchan});
+            }
+        }
+        const double wtime = seconds_since(start);
+        const long fsize = file_size(fname);
+
+        start = clock_type::now();
+        {
+            Sio::NpzReader npz(fname);
+            for (int count=0; count<nrepeat; ++count) {
+                const auto got = npz.get("frame_" + std::to_string(count)).copy<T>();
+                assert(got == frame);
+            }
+        }
+        const double rtime = seconds_since(start);
+
+        std::cout << dtype << " " << setting.codec << ":" << setting.level
+                  << " write " << mb/wtime << " MB/s"
+                  << " read " << mb/rtime << " MB/s"
+                  << " ratio " << nrepeat*frame.size()*sizeof(T) / double(fsize)
+                  << "\n";
+    }
+    remove(fname.c_str());
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t nchan = argc > 1 ? atoi(argv[1]) : 2560;
+    const size_t ntick = argc > 2 ? atoi(argv[2]) : 6000;
+    const int nrepeat = argc > 3 ? atoi(argv[3]) : 2;
+
+    std::mt19937 rng(12345);
+    std::normal_distribution<float> noise(0.0, 3.0);
+    std::vector<float> fframe(nchan*ntick);
+    for (size_t itick=0; itick<ntick; ++itick) {
+        for (size_t ichan=0; ichan<nchan; ++ichan) {
+            fframe[itick*nchan + ichan] = 900 + noise(rng);
+        }
+    }
+    for (size_t ichan=0; ichan<nchan; ichan += 7) { // a track-like pulse
+        const double t0 = (ichan * 2) % ntick;
+        for (int dt=-20; dt<=20; ++dt) {
+            const int itick = t0 + dt;
+            if (itick >= 0 and itick < (int)ntick) {
+                fframe[itick*nchan + ichan] += 200*std::exp(-0.5*dt*dt/25.0);
+            }
+        }
+    }
+    std::vector<short> sframe(fframe.size());
+    for (size_t ind=0; ind<fframe.size(); ++ind) {
+        sframe[ind] = std::lround(fframe[ind]);
+    }
+
+    std::cout << nchan << " channels x " << ntick << " ticks x " << nrepeat << "\n";
+    bench("int16", sframe, nchan, ntick, nrepeat);
+    bench("float32", fframe, nchan, ntick, nrepeat);
+    return 0;
+}
@@ -0,0 +1,360 @@
+// Benchmark the Sio read and write paths on synthetic data.
+//
+// Depos with uniform positions and times and frames of baseline plus
+// Gaussian noise are made from a fixed seed, so runs are repeatable.
+// Each of BeeDepoSource, JsonDepoSource, NumpyDepoSaver and
+// NumpyFrameSaver is then driven directly through its interface.
+// Each benchmark runs in its own process so that its peak RSS can be
+// measured alone.  It is timed nrepeat times, and its line reports:
+//
+// - the median time and the rate of items (depos or frames);
+// - MB/s of the file read or written;
+// - heap allocations per item, counted by a replaced operator new;
+// - the peak RSS of its process.
+//
+//   check_sio_bench [ndepos [nchan [ntick [nrepeat]]]]
+
+#include "WireCellSio/BeeDepoSource.h"
+#include "WireCellSio/JsonDepoSource.h"
+#include "WireCellSio/NumpyDepoSaver.h"
+#include "WireCellSio/NumpyFrameSaver.h"
+#include "WireCellIface/SimpleDepo.h"
+#include "WireCellIface/SimpleFrame.h"
+#include "WireCellIface/SimpleTrace.h"
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace WireCell;
+
+// Count heap allocations of this process.
+static std::atomic<size_t> g_nallocs(0);
+
+// The replacements pair malloc() and free() as a matching set, which
+// GCC can not see once they are inlined into callers.
+#if defined(__GNUC__) and !defined(__clang__) and __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size)
+{
+    ++g_nallocs;
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return ::operator new(size); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+#if defined(__GNUC__) and !defined(__clang__) and __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+typedef std::chrono::steady_clock clock_type;
+
+struct Measure {
+    size_t items;               // depos or frames
+    size_t bytes;               // file bytes read or written
+    double seconds;
+    size_t nallocs;
+};
+
+static size_t file_size(const std::string& fname)
+{
+    struct stat st;
+    if (stat(fname.c_str(), &st) != 0) {
+        return 0;
+    }
+    return st.st_size;
+}
+
+// Time body, which returns the number of items it handled.
+static Measure measure(std::function<size_t()> body)
+{
+    const size_t nallocs = g_nallocs;
+    const auto start = clock_type::now();
+    const size_t items = body();
+    const double seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+    return Measure{items, 0, seconds, g_nallocs - nallocs};
+}
+
+// Return the repeat with the median time.
+static Measure median(std::vector<Measure> ms)
+{
+    std::sort(ms.begin(), ms.end(), [](const Measure& a, const Measure& b) {
+        return a.seconds < b.seconds;
+    });
+    return ms[ms.size()/2];
+}
+
+// Run bench in a child process and print its line.
+static void run(const std::string& name, std::function<Measure()> bench)
+{
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+    std::cout.flush();
+    const pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        const Measure m = bench();
+        const bool ok = write(fds[1], &m, sizeof(m)) == sizeof(m);
+        _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    Measure m{0, 0, 0, 0};
+    const bool ok = read(fds[0], &m, sizeof(m)) == sizeof(m);
+    close(fds[0]);
+    int status = 0;
+    struct rusage ru;
+    wait4(pid, &status, 0, &ru);
+    if (!ok or !WIFEXITED(status) or WEXITSTATUS(status) != 0) {
+        std::cout << name << " FAILED\n";
+        return;
+    }
+#ifdef __APPLE__
+    const double rss_mb = ru.ru_maxrss / 1e6;
+#else
+    const double rss_mb = ru.ru_maxrss / 1e3;
+#endif
+    std::cout << name
+              << " items " << m.items
+              << " time " << m.seconds << " s"
+              << " rate " << m.items/m.seconds << " /s"
+              << " io " << m.bytes/m.seconds/1e6 << " MB/s"
+              << " allocs/item " << double(m.nallocs)/m.items
+              << " peak_rss " << rss_mb << " MB\n";
+}
+
+struct DepoData {
+    std::vector<double> t, x, y, z, q;
+};
+
+static DepoData make_depo_data(size_t ndepos)
+{
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<double> pos(-300.0, 300.0);
+    std::uniform_real_distribution<double> time(0.0, 5000.0);
+    std::uniform_real_distribution<double> charge(100.0, 10000.0);
+    DepoData dd;
+    for (size_t ind=0; ind<ndepos; ++ind) {
+        dd.t.push_back(time(rng));
+        dd.x.push_back(pos(rng));
+        dd.y.push_back(pos(rng));
+        dd.z.push_back(pos(rng));
+        dd.q.push_back(charge(rng));
+    }
+    return dd;
+}
+
+static void write_bee(const std::string& fname, const DepoData& dd, size_t beg, size_t end)
+{
+    FILE* fp = fopen(fname.c_str(), "w");
+    assert(fp);
+    fprintf(fp, "{\"runNo\":\"1\",\"subRunNo\":\"0\",\"eventNo\":\"1\",\"type\":\"truthDepo\"");
+    const std::vector<std::pair<const char*, const std::vector<double>*> > cols{
+        {"t", &dd.t}, {"x", &dd.x}, {"y", &dd.y}, {"z", &dd.z}, {"q", &dd.q}};
+    for (const auto& col : cols) {
+        fprintf(fp, ",\n\"%s\":[", col.first);
+        for (size_t ind=beg; ind<end; ++ind) {
+            fprintf(fp, "%s%.6g", ind == beg ? "" : ",", (*col.second)[ind]);
+        }
+        fprintf(fp, "]");
+    }
+    fprintf(fp, "}\n");
+    fclose(fp);
+}
+
+static void write_json(const std::string& fname, const DepoData& dd)
+{
+    FILE* fp = fopen(fname.c_str(), "w");
+    assert(fp);
+    fprintf(fp, "{\"depos\":[\n");
+    for (size_t ind=0; ind<dd.t.size(); ++ind) {
+        fprintf(fp, "%s{\"t\":%.6g,\"x\":%.6g,\"y\":%.6g,\"z\":%.6g,\"n\":%.6g}\n",
+                ind ? "," : "", dd.t[ind], dd.x[ind], dd.y[ind], dd.z[ind], dd.q[ind]);
+    }
+    fprintf(fp, "]}\n");
+    fclose(fp);
+}
+
+// Drain a depo source until it is exhausted, counting depos.
+static size_t drain(IDepoSource& source)
+{
+    size_t count = 0;
+    IDepo::pointer depo;
+    while (source(depo)) {
+        if (depo) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t ndepos = argc > 1 ? atoi(argv[1]) : 1000000;
+    const size_t nchan = argc > 2 ? atoi(argv[2]) : 2560;
+    const size_t ntick = argc > 3 ? atoi(argv[3]) : 6000;
+    const int nrepeat = argc > 4 ? atoi(argv[4]) : 5;
+    const size_t nfiles = 4, nframes = 2;
+
+    std::cout << ndepos << " depos, " << nframes << " frames of "
+              << nchan << " channels x " << ntick << " ticks, "
+              << nrepeat << " repeats\n";
+
+    const DepoData dd = make_depo_data(ndepos);
+
+    std::vector<std::string> bee_files;
+    size_t bee_bytes = 0;
+    for (size_t ifile=0; ifile<nfiles; ++ifile) {
+        bee_files.push_back("check_sio_bench_bee" + std::to_string(ifile) + ".json");
+        write_bee(bee_files.back(), dd, ifile*ndepos/nfiles, (ifile+1)*ndepos/nfiles);
+        bee_bytes += file_size(bee_files.back());
+    }
+    const std::string json_file = "check_sio_bench_depos.json";
+    write_json(json_file, dd);
+    const std::string depo_npz = "check_sio_bench_depos.npz";
+    const std::string frame_npz = "check_sio_bench_frames.npz";
+
+    struct BeeSetting { std::string name; int readahead, workers; };
+    const std::vector<BeeSetting> bee_settings{
+        {"serial", 0, 0}, {"readahead2", 2, 0}, {"workers2", 1, 2}, {"workers4", 1, 4}};
+    for (const auto& setting : bee_settings) {
+        run("BeeDepoSource:" + setting.name, [&]() {
+            std::vector<Measure> ms;
+            for (int count=0; count<nrepeat; ++count) {
+                Sio::BeeDepoSource source;
+                auto cfg = source.default_configuration();
+                for (const auto& fname : bee_files) {
+                    cfg["filelist"].append(fname);
+                }
+                cfg["policy"] = "stream";
+                cfg["readahead"] = setting.readahead;
+                cfg["workers"] = setting.workers;
+                source.configure(cfg);
+                ms.push_back(measure([&]() { return drain(source); }));
+                ms.back().bytes = bee_bytes;
+            }
+            return median(ms);
+        });
+    }
+
+    for (const bool stream : {false, true}) {
+        run(std::string("JsonDepoSource:") + (stream ? "stream" : "load"), [&]() {
+            std::vector<Measure> ms;
+            for (int count=0; count<nrepeat; ++count) {
+                Sio::JsonDepoSource source;
+                auto cfg = source.default_configuration();
+                cfg["filename"] = json_file;
+                cfg["stream"] = stream;
+                source.configure(cfg);
+                ms.push_back(measure([&]() { return drain(source); }));
+                ms.back().bytes = file_size(json_file);
+            }
+            return median(ms);
+        });
+    }
+
+    for (const int chunk_size : {0, 65536}) {
+        run("NumpyDepoSaver:chunk" + std::to_string(chunk_size), [&]() {
+            // Every tenth depo has a prior, shared by ten depos.
+            IDepo::vector depos;
+            IDepo::pointer prior;
+            for (size_t ind=0; ind<ndepos; ++ind) {
+                if (ind % 100 == 0) {
+                    prior = std::make_shared<SimpleDepo>(dd.t[ind], Point(dd.x[ind], dd.y[ind], dd.z[ind]), dd.q[ind]);
+                }
+                depos.push_back(std::make_shared<SimpleDepo>(
+                                    dd.t[ind], Point(dd.x[ind], dd.y[ind], dd.z[ind]), -dd.q[ind],
+                                    ind % 10 ? nullptr : prior, 1.0, 2.0, ind, 11));
+            }
+            std::vector<Measure> ms;
+            for (int count=0; count<nrepeat; ++count) {
+                remove(depo_npz.c_str());
+                Sio::NumpyDepoSaver saver;
+                auto cfg = saver.default_configuration();
+                cfg["filename"] = depo_npz;
+                cfg["chunk_size"] = chunk_size;
+                saver.configure(cfg);
+                ms.push_back(measure([&]() {
+                    IDepo::pointer out;
+                    for (const auto& depo : depos) {
+                        saver(depo, out);
+                    }
+                    saver(nullptr, out);
+                    return depos.size();
+                }));
+                ms.back().bytes = file_size(depo_npz);
+            }
+            remove(depo_npz.c_str());
+            return median(ms);
+        });
+    }
+
+    for (const std::string dtype : {"float32", "int16"}) {
+        run("NumpyFrameSaver:" + dtype, [&]() {
+            std::mt19937 rng(12345);
+            std::normal_distribution<float> noise(0.0, 3.0);
+            std::vector<IFrame::pointer> frames;
+            for (size_t iframe=0; iframe<nframes; ++iframe) {
+                ITrace::vector traces;
+                for (size_t ichan=0; ichan<nchan; ++ichan) {
+                    ITrace::ChargeSequence charge(ntick);
+                    for (auto& q : charge) {
+                        q = 900 + noise(rng);
+                    }
+                    traces.push_back(std::make_shared<SimpleTrace>(ichan, 0, charge));
+                }
+                frames.push_back(std::make_shared<SimpleFrame>(iframe, 0.0, traces, 0.5*units::us));
+            }
+            std::vector<Measure> ms;
+            for (int count=0; count<nrepeat; ++count) {
+                remove(frame_npz.c_str());
+                Sio::NumpyFrameSaver saver;
+                auto cfg = saver.default_configuration();
+                cfg["filename"] = frame_npz;
+                cfg["dtype"] = dtype;
+                saver.configure(cfg);
+                ms.push_back(measure([&]() {
+                    IFrame::pointer out;
+                    for (const auto& frame : frames) {
+                        saver(frame, out);
+                    }
+                    saver(nullptr, out);
+                    return frames.size();
+                }));
+                ms.back().bytes = file_size(frame_npz);
+            }
+            remove(frame_npz.c_str());
+            return median(ms);
+        });
+    }
+
+    for (const auto& fname : bee_files) {
+        remove(fname.c_str());
+    }
+    remove(json_file.c_str());
+    return 0;
+}
@@ -0,0 +1,314 @@
+// Check the order in which BeeDepoSource emits depos and EOS when
+// sorting each file and when merging groups of files, and that
+// decoding with workers gives the same order, also around an empty
+// file and a file that fails to decode.  Also check how missing and
+// malformed columns are decoded.
+
+#include "WireCellSio/BeeDepoSource.h"
+#include "WireCellUtil/Exceptions.h"
+#include "WireCellUtil/Persist.h"
+#include "WireCellUtil/Testing.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace WireCell;
+
+// An emitted depo by its x, which is unique, an EOS or an error.
+static const int eos = -1;
+static const int failed = -2;
+typedef std::vector<int> Sequence;
+
+// Depo times of each file.  Depo i of file f has x = 100*f + i.
+typedef std::vector< std::vector<double> > Files;
+
+// Write the files, giving the "broken" one columns of differing length.
+static std::vector<std::string> write_files(const std::string& prefix, const Files& files,
+                                            size_t broken = std::string::npos)
+{
+    std::vector<std::string> fnames;
+    for (size_t ifile=0; ifile<files.size(); ++ifile) {
+        Json::Value jdat;
+        jdat["type"] = "truthDepo";
+        for (const char* key : {"t", "x", "y", "z", "q"}) {
+            jdat[key] = Json::arrayValue;
+        }
+        for (size_t ind=0; ind<files[ifile].size(); ++ind) {
+            jdat["t"].append(files[ifile][ind]);
+            jdat["x"].append((int)(100*ifile + ind));
+            jdat["y"].append(0.0);
+            jdat["z"].append(0.0);
+            jdat["q"].append(1.0);
+        }
+        if (ifile == broken) {
+            jdat["x"].append(0.0);
+        }
+        const std::string fname = prefix + std::to_string(ifile) + ".json";
+        Persist::dump(fname, jdat);
+        fnames.push_back(fname);
+    }
+    return fnames;
+}
+
+static Sequence read_all(const std::vector<std::string>& fnames, Configuration extra)
+{
+    Sio::BeeDepoSource source;
+    auto cfg = source.default_configuration();
+    for (const auto& fname : fnames) {
+        cfg["filelist"].append(fname);
+    }
+    for (const auto& key : extra.getMemberNames()) {
+        cfg[key] = extra[key];
+    }
+    source.configure(cfg);
+
+    Sequence got;
+    IDepo::pointer depo;
+    try {
+        while (source(depo)) {
+            got.push_back(depo ? (int)depo->pos().x() : eos);
+        }
+    }
+    catch (const ValueError&) {
+        got.push_back(failed);
+    }
+    return got;
+}
+
+// The order expected for groups of "merge" files, each sorted by
+// time with ties in file order and then in order within a file.
+static Sequence expected(const Files& files, size_t merge)
+{
+    Sequence want;
+    for (size_t first=0; first<files.size(); first += merge) {
+        std::vector< std::tuple<double, size_t, size_t> > group; // (t, file, index)
+        for (size_t ifile=first; ifile<std::min(first+merge, files.size()); ++ifile) {
+            for (size_t ind=0; ind<files[ifile].size(); ++ind) {
+                group.emplace_back(files[ifile][ind], ifile, ind);
+            }
+        }
+        if (group.empty()) {    // no EOS for a group without depos
+            continue;
+        }
+        std::sort(group.begin(), group.end());
+        for (const auto& tfi : group) {
+            want.push_back(100*std::get<1>(tfi) + std::get<2>(tfi));
+        }
+        want.push_back(eos);
+    }
+    return want;
+}
+
+// Decode one file, with the given defaults unless null.
+static IDepo::vector decode(const Json::Value& jdat, const Configuration& defaults)
+{
+    const std::string fname = "test_beedepoorder_columns.json";
+    Persist::dump(fname, jdat);
+    Sio::BeeDepoSource source;
+    auto cfg = source.default_configuration();
+    cfg["filelist"].append(fname);
+    if (!defaults.isNull()) {
+        cfg["defaults"] = defaults;
+    }
+    source.configure(cfg);
+
+    IDepo::vector depos;
+    IDepo::pointer depo;
+    try {
+        while (source(depo) and depo) {
+            depos.push_back(depo);
+        }
+    }
+    catch (const ValueError&) {
+        remove(fname.c_str());
+        throw;
+    }
+    remove(fname.c_str());
+    return depos;
+}
+
+static bool fails(const Json::Value& jdat, const Configuration& defaults)
+{
+    try {
+        decode(jdat, defaults);
+    }
+    catch (const ValueError&) {
+        return true;
+    }
+    return false;
+}
+
+static void check_columns()
+{
+    Json::Value jdat;
+    for (const char* key : {"x", "y", "z", "q"}) {
+        jdat[key] = Json::arrayValue;
+        jdat[key].append(1.0);
+        jdat[key].append(2.0);
+    }
+    jdat["nq"] = "ignored";
+
+    // No "t", by default 0.
+    auto depos = decode(jdat, Configuration());
+    Assert(depos.size() == 2);
+    for (const auto& depo : depos) {
+        Assert(depo->time() == 0);
+    }
+    Assert(depos[1]->pos().x() == 2.0 and depos[1]->charge() == 2.0);
+
+    // Any other column missing needs a configured default.
+    for (const char* key : {"x", "y", "z", "q"}) {
+        Json::Value jmiss = jdat;
+        jmiss.removeMember(key);
+        Assert(fails(jmiss, Configuration()));
+    }
+    {
+        Json::Value jmiss = jdat;
+        jmiss.removeMember("q");
+        Configuration defaults;
+        defaults["t"] = 5.0;
+        defaults["q"] = 7.0;
+        depos = decode(jmiss, defaults);
+        Assert(depos.size() == 2);
+        for (const auto& depo : depos) {
+            Assert(depo->time() == 5.0 and depo->charge() == 7.0);
+        }
+        defaults.removeMember("t"); // and "t" has no default of its own
+        Assert(fails(jmiss, defaults));
+    }
+
+    // Malformed columns.
+    {
+        Json::Value jbad = jdat;
+        jbad["y"] = 3.0;
+        Assert(fails(jbad, Configuration()));
+    }
+    {
+        Json::Value jbad = jdat;
+        jbad["z"].append(3.0);
+        Assert(fails(jbad, Configuration()));
+    }
+    std::cerr << "columns: ok\n";
+}
+
+// Negative thread and file counts are rejected, not wrapped.
+static void check_config()
+{
+    for (const char* key : {"readahead", "workers", "merge"}) {
+        for (int val : {-1, 0}) {
+            Sio::BeeDepoSource source;
+            auto cfg = source.default_configuration();
+            cfg[key] = val;
+            bool threw = false;
+            try {
+                source.configure(cfg);
+            }
+            catch (const ValueError&) {
+                threw = true;
+            }
+            Assert(threw == (val < 0 or std::string(key) == "merge"));
+        }
+    }
+    std::cerr << "config: ok\n";
+}
+
+int main()
+{
+    check_config();
+    check_columns();
+
+    const Files files{
+        {3, 1, 2, 1, 0},        // ties within a file
+        {1, 0, 3},              // ties with the file before
+        {2, 2, 1},
+        {5, 4},
+        {1},
+    };
+    const auto fnames = write_files("test_beedepoorder_", files);
+
+    // Without sorting, each file as is.
+    {
+        Configuration cfg;
+        const auto got = read_all(fnames, cfg);
+        Sequence want;
+        for (size_t ifile=0; ifile<files.size(); ++ifile) {
+            for (size_t ind=0; ind<files[ifile].size(); ++ind) {
+                want.push_back(100*ifile + ind);
+            }
+            want.push_back(eos);
+        }
+        Assert(got == want);
+    }
+
+    for (bool arena : {false, true}) {
+        for (int merge : {1, 2, 3, 5, 8}) {
+            Configuration cfg;
+            cfg["sort"] = true;
+            cfg["merge"] = merge;
+            cfg["arena"] = arena;
+            const auto got = read_all(fnames, cfg);
+            Assert(got == expected(files, merge));
+
+            // Streaming sends the same depos with no EOS.
+            cfg["policy"] = "stream";
+            auto want = expected(files, merge);
+            want.erase(std::remove(want.begin(), want.end(), eos), want.end());
+            Assert(read_all(fnames, cfg) == want);
+        }
+    }
+    std::cerr << "sort and merge: ok\n";
+    for (const auto& fname : fnames) {
+        remove(fname.c_str());
+    }
+
+    // Workers must give what decoding in line gives.  The empty file
+    // is skipped, with no EOS of its own.  The broken one fails only
+    // once every group before it has been sent.
+    const Files more{
+        {3, 1, 2}, {1, 0}, {}, {2, 2, 1}, {5, 4}, {1}, {0, 0}, {4}, {2, 3},
+    };
+    const size_t broken = 5;
+    const auto good = write_files("test_beedepoorder_good_", more);
+    const auto bad = write_files("test_beedepoorder_bad_", more, broken);
+    for (int merge : {1, 2, 3}) {
+        for (bool sort : {false, true}) {
+            Configuration cfg;
+            cfg["sort"] = sort;
+            cfg["merge"] = merge;
+            const auto want_good = read_all(good, cfg);
+            const auto want_bad = read_all(bad, cfg);
+            if (sort) {
+                Assert(want_good == expected(more, merge));
+                const size_t nbefore = broken - broken % merge;
+                auto want = expected(Files(more.begin(), more.begin() + nbefore), merge);
+                want.push_back(failed);
+                Assert(want_bad == want);
+            }
+            const auto ends = expected(more, merge);
+            Assert(std::count(want_good.begin(), want_good.end(), eos)
+                   == std::count(ends.begin(), ends.end(), eos));
+            Assert(want_bad.back() == failed);
+            for (int workers : {1, 2, 3, 4}) {
+                for (int readahead : {0, 1, 3}) {
+                    cfg["workers"] = workers;
+                    cfg["readahead"] = readahead;
+                    Assert(read_all(good, cfg) == want_good);
+                    Assert(read_all(bad, cfg) == want_bad);
+                }
+            }
+        }
+    }
+    std::cerr << "workers: ok\n";
+    for (const auto& fname : good) {
+        remove(fname.c_str());
+    }
+    for (const auto& fname : bad) {
+        remove(fname.c_str());
+    }
+    std::cerr << "test_beedepoorder: ok\n";
+    return 0;
+}
@@ -0,0 +1,83 @@
+// Check that JsonDepoSource emits depos in (t, x) order when its sort
+// window is smaller than the input so runs are spilled and merged.
+
+#include "WireCellSio/JsonDepoSource.h"
+#include "WireCellUtil/Persist.h"
+#include "WireCellUtil/Units.h"
+#include "WireCellUtil/Testing.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <tuple>
+#include <vector>
+
+using namespace WireCell;
+
+typedef std::tuple<double, double, double> TXQ;
+
+static std::vector<TXQ> read_all(const std::string& fname, int window, bool stream)
+{
+    Sio::JsonDepoSource source;
+    auto cfg = source.default_configuration();
+    cfg["filename"] = fname;
+    cfg["window"] = window;
+    cfg["stream"] = stream;
+    source.configure(cfg);
+
+    std::vector<TXQ> got;
+    while (true) {
+        IDepo::pointer depo;
+        Assert(source(depo));
+        if (!depo) {
+            break;
+        }
+        got.emplace_back(depo->time(), depo->pos().x(), depo->charge());
+    }
+    IDepo::pointer end;
+    Assert(!source(end));
+    return got;
+}
+
+int main()
+{
+    const std::string fname = "test_jsondeposource.json";
+    const int ndepos = 100;
+
+    // Few distinct times so many depos tie on t and are ordered by x.
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> tdist(0, 9);
+    std::vector<int> xs(ndepos);
+    for (int ind=0; ind<ndepos; ++ind) {
+        xs[ind] = ind;
+    }
+    std::shuffle(xs.begin(), xs.end(), rng);
+
+    Json::Value jtop;
+    std::vector<TXQ> want;
+    for (int ind=0; ind<ndepos; ++ind) {
+        Json::Value jdepo;
+        jdepo["t"] = tdist(rng)*units::us;
+        jdepo["x"] = xs[ind];
+        jdepo["y"] = 0.0;
+        jdepo["z"] = 0.0;
+        jdepo["n"] = ind + 1;
+        jtop["depos"].append(jdepo);
+        want.emplace_back(jdepo["t"].asDouble(), xs[ind], -(ind + 1)*units::eplus);
+    }
+    Persist::dump(fname, jtop);
+    std::sort(want.begin(), want.end());
+
+    for (bool stream : {false, true}) {
+        for (int window : {0, 7, 10, 99, 100, 1000}) {
+            const auto got = read_all(fname, window, stream);
+            std::cerr << "window=" << window << " stream=" << stream
+                      << ": " << got.size() << " depos\n";
+            Assert(got == want);
+        }
+    }
+    remove(fname.c_str());
+    std::cerr << "test_jsondeposource: ok\n";
+    return 0;
+}
@@ -0,0 +1,152 @@
+// Round trip depos through NumpyDepoSaver and NpzDepoSource.
+
+#include "WireCellSio/NumpyDepoSaver.h"
+#include "WireCellSio/NpzDepoSource.h"
+#include "WireCellSio/NpzReader.h"
+#include "WireCellIface/SimpleDepo.h"
+#include "WireCellUtil/Testing.h"
+
+#include <cstdio>
+#include <iostream>
+
+using namespace WireCell;
+
+// Depos that are received and also the prior of another received
+// depo, before or after it, are saved once and read back once.
+static void check_received_priors(int chunk_size)
+{
+    const std::string fname = "test_npzdeposource_priors.npz";
+    remove(fname.c_str());
+
+    auto make = [](int id, IDepo::pointer prior) {
+        return std::make_shared<SimpleDepo>(id*units::us, Point(id,0,0), -100.0*id,
+                                            prior, 0.0, 0.0, id, 11);
+    };
+    auto a = make(0, nullptr);
+    auto b = make(1, a);        // a received before
+    auto e = make(4, nullptr);
+    auto d = make(3, e);
+    auto c = make(2, d);        // d received after
+    {
+        Sio::NumpyDepoSaver saver;
+        auto cfg = saver.default_configuration();
+        cfg["filename"] = fname;
+        cfg["chunk_size"] = chunk_size;
+        saver.configure(cfg);
+        for (auto depo : {a, b, c, d}) {
+            IDepo::pointer out;
+            Assert(saver(depo, out) and out == depo);
+        }
+        IDepo::pointer eos;
+        saver(nullptr, eos);
+    }
+    if (!chunk_size) {
+        Sio::NpzReader reader(fname);
+        const auto arr = reader.get("depo_info_0");
+        const size_t nrows = 5;
+        Assert(arr.shape.size() == 2 and arr.shape[1] == nrows);
+        const auto info = arr.copy<int>();
+        const std::vector<int> gen{0, 0, 0, 0, 2}, child{2, 0, 0, 3, 4}, prior{0, 1, 4, 5, 0};
+        for (size_t row=0; row<nrows; ++row) {
+            Assert(info[2*nrows + row] == gen[row]);
+            Assert(info[3*nrows + row] == child[row]);
+            Assert(info[4*nrows + row] == prior[row]);
+        }
+    }
+
+    Sio::NpzDepoSource source;
+    auto cfg = source.default_configuration();
+    cfg["filename"] = fname;
+    source.configure(cfg);
+    IDepo::vector got;
+    while (true) {
+        IDepo::pointer depo;
+        Assert(source(depo));
+        if (!depo) {
+            break;
+        }
+        got.push_back(depo);
+    }
+    Assert(got.size() == 4);
+    for (int ind=0; ind<4; ++ind) {
+        Assert(got[ind]->id() == ind);
+    }
+    Assert(!got[0]->prior());
+    Assert(got[1]->prior() == got[0]);
+    Assert(got[2]->prior() == got[3]);
+    Assert(got[3]->prior() and got[3]->prior()->id() == 4);
+    remove(fname.c_str());
+}
+
+int main()
+{
+    for (int chunk_size : {0, 3, 100}) {
+        check_received_priors(chunk_size);
+    }
+    std::cerr << "received priors: ok\n";
+
+    const std::string fname = "test_npzdeposource.npz";
+    remove(fname.c_str());
+
+    const int nevents = 2, ndepos = 10;
+    {
+        Sio::NumpyDepoSaver saver;
+        auto cfg = saver.default_configuration();
+        cfg["filename"] = fname;
+        cfg["chunk_size"] = 4;
+        saver.configure(cfg);
+
+        // one prior shared by all odd depos
+        auto shared = std::make_shared<SimpleDepo>(0.0, Point(0,0,0), 100.0, nullptr, 0, 0, 42, 13);
+        for (int event=0; event<nevents; ++event) {
+            for (int ind=0; ind<ndepos; ++ind) {
+                IDepo::pointer prior = (ind%2) ? shared : nullptr;
+                auto depo = std::make_shared<SimpleDepo>(ind*units::us, Point(ind,2*ind,3*ind),
+                                                         -1000.0*ind, prior, 1.0, 2.0, ind, 11);
+                IDepo::pointer out;
+                bool ok = saver(depo, out);
+                Assert(ok and out == depo);
+            }
+            IDepo::pointer eos;
+            saver(nullptr, eos);
+            Assert(!eos);
+        }
+    }
+
+    Sio::NpzDepoSource source;
+    auto cfg = source.default_configuration();
+    cfg["filename"] = fname;
+    source.configure(cfg);
+
+    for (int event=0; event<nevents; ++event) {
+        IDepo::pointer shared;
+        for (int ind=0; ind<ndepos; ++ind) {
+            IDepo::pointer depo;
+            bool ok = source(depo);
+            Assert(ok and depo);
+            Assert(depo->id() == ind);
+            Assert(depo->pdg() == 11);
+            Assert(depo->time() == (float)(ind*units::us));
+            Assert(depo->pos().z() == 3*ind);
+            Assert(depo->charge() == -1000.0*ind);
+            Assert(depo->extent_tran() == 2.0);
+            auto prior = depo->prior();
+            if (ind%2 == 0) {
+                Assert(!prior);
+                continue;
+            }
+            Assert(prior and prior->id() == 42 and !prior->prior());
+            if (shared) {
+                Assert(prior == shared); // saved and restored once
+            }
+            shared = prior;
+        }
+        IDepo::pointer eos;
+        bool ok = source(eos);
+        Assert(ok and !eos);
+    }
+    IDepo::pointer end;
+    Assert(!source(end));
+    std::cerr << "test_npzdeposource: ok\n";
+    return 0;
+}
@@ -0,0 +1,109 @@
+// Check that NpzWriter produces the same bytes as a sequence of
+// cnpy::npz_save() calls in append mode, both when writing
+// synchronously and through its I/O thread and from prepared entries.
+
+#include "WireCellSio/NpzWriter.h"
+#include "WireCellUtil/cnpy.h"
+#include "WireCellUtil/Testing.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace WireCell;
+
+static std::string slurp(const std::string& fname)
+{
+    std::ifstream fstr(fname, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(fstr), std::istreambuf_iterator<char>());
+}
+
+static void save(const std::string& fname, int count, bool withcnpy, size_t depth=0,
+                 bool prepared=false)
+{
+    std::vector<float> frame(6*4);
+    for (size_t ind=0; ind<frame.size(); ++ind) {
+        frame[ind] = count*100 + ind;
+    }
+    std::vector<int> chans{1,2,3,4};
+    std::vector<double> tickinfo{0.0, 0.5, (double)count};
+    const std::string fn = "frame_" + std::to_string(count);
+    const std::string cn = "channels_" + std::to_string(count);
+    const std::string tn = "tickinfo_" + std::to_string(count);
+    if (withcnpy) {
+        cnpy::npz_save(fname, fn, frame.data(), {6,4}, "a");
+        cnpy::npz_save(fname, cn, chans.data(), {4}, "a");
+        cnpy::npz_save(fname, tn, tickinfo.data(), {3}, "a");
+        return;
+    }
+    Sio::NpzWriter npz;
+    npz.open(fname, depth);
+    if (prepared) {
+        // The frame is kept by its entry, not copied, the rest copied.
+        auto shared = std::make_shared< std::vector<float> >(frame);
+        auto entry = Sio::NpzWriter::prepare(fn, std::shared_ptr<const float>(shared, shared->data()),
+                                             {6,4}, 0);
+        Assert(entry.stored == entry.header);
+        shared.reset();
+        npz.write(std::move(entry));
+        npz.write(Sio::NpzWriter::prepare(cn, chans.data(), {4}, 0));
+        npz.write(Sio::NpzWriter::prepare(tn, tickinfo.data(), {3}, 0));
+        return;
+    }
+    npz.write(fn, frame.data(), {6,4});
+    npz.write(cn, chans.data(), {4});
+    npz.write(tn, tickinfo.data(), {3});
+}
+
+int main()
+{
+    const std::string want = "test_npzwriter_cnpy.npz";
+    const std::string got = "test_npzwriter_sio.npz";
+    const std::string got_async = "test_npzwriter_async.npz";
+    const std::string got_prep = "test_npzwriter_prepared.npz";
+    remove(want.c_str());
+    remove(got.c_str());
+    remove(got_async.c_str());
+    remove(got_prep.c_str());
+
+    for (int count=0; count<3; ++count) {
+        save(want, count, true);
+    }
+
+    {                           // held open across several saves
+        Sio::NpzWriter npz;
+        npz.open(got);
+        std::vector<float> frame(6*4);
+        for (size_t ind=0; ind<frame.size(); ++ind) {
+            frame[ind] = ind;
+        }
+        std::vector<int> chans{1,2,3,4};
+        std::vector<double> tickinfo{0.0, 0.5, 0.0};
+        npz.write("frame_0", frame.data(), {6,4});
+        npz.write("channels_0", chans.data(), {4});
+        npz.flush();            // directory written mid-stream
+        npz.write("tickinfo_0", tickinfo.data(), {3});
+    }
+    for (int count=1; count<3; ++count) { // and reopened for append
+        save(got, count, false);
+    }
+    for (int count=0; count<3; ++count) {
+        save(got_async, count, false, 2);
+    }
+    for (int count=0; count<3; ++count) {
+        save(got_prep, count, false, count, true);
+    }
+
+    const std::string wbytes = slurp(want), gbytes = slurp(got);
+    std::cerr << want << ": " << wbytes.size() << " bytes, "
+              << got << ": " << gbytes.size() << " bytes\n";
+    Assert(wbytes.size() > 0);
+    Assert(wbytes == gbytes);
+    Assert(wbytes == slurp(got_async));
+    Assert(wbytes == slurp(got_prep));
+    return 0;
+}
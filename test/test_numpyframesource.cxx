@@ -0,0 +1,222 @@
+// Round trip frames through NumpyFrameSaver and NumpyFrameSource,
+// saved both dense and sparse, and check both give the same traces,
+// also when packed as 12 bit samples.
+
+#include "WireCellSio/NumpyFrameSaver.h"
+#include "WireCellSio/NumpyFrameSource.h"
+#include "WireCellSio/NpzReader.h"
+#include "WireCellIface/SimpleFrame.h"
+#include "WireCellIface/SimpleTrace.h"
+#include "WireCellUtil/Testing.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace WireCell;
+
+// channel -> (tbin, samples)
+typedef std::map<int, std::pair<int, std::vector<float> > > Traces;
+
+// The traces of a frame holding at most one per channel.
+static Traces by_channel(const IFrame::pointer& frame)
+{
+    Traces traces;
+    for (const auto& trace : *frame->traces()) {
+        Assert(traces.count(trace->channel()) == 0);
+        const auto& charge = trace->charge();
+        traces[trace->channel()] = std::make_pair(trace->tbin(),
+                                                  std::vector<float>(charge.begin(), charge.end()));
+    }
+    return traces;
+}
+
+static IFrame::pointer make_frame(int ident)
+{
+    ITrace::vector traces{
+        // overlapping traces on one channel, zeros inside them
+        std::make_shared<SimpleTrace>(3, 10, ITrace::ChargeSequence{1, 0, 2, 3}),
+        std::make_shared<SimpleTrace>(3, 12, ITrace::ChargeSequence{1, 1, 0, 0, 5}),
+        // a channel with no nonzero sample
+        std::make_shared<SimpleTrace>(7, 20, ITrace::ChargeSequence{0, 0, 0}),
+        std::make_shared<SimpleTrace>(1, 5, ITrace::ChargeSequence{4, -2}),
+        std::make_shared<SimpleTrace>(9, 30, ITrace::ChargeSequence{7, 0, 0, 8.5}),
+    };
+    return std::make_shared<SimpleFrame>(ident, ident*units::ms, traces, 0.5*units::us);
+}
+
+static void save(const std::string& fname, const Configuration& extra,
+                 const std::vector<IFrame::pointer>& frames)
+{
+    remove(fname.c_str());
+    Sio::NumpyFrameSaver saver;
+    auto cfg = saver.default_configuration();
+    cfg["filename"] = fname;
+    for (const auto& key : extra.getMemberNames()) {
+        cfg[key] = extra[key];
+    }
+    saver.configure(cfg);
+    for (const auto& frame : frames) {
+        IFrame::pointer out;
+        Assert(saver(frame, out));
+    }
+    IFrame::pointer eos;
+    saver(nullptr, eos);
+    Assert(!eos);
+}
+
+static std::vector<IFrame::pointer> load(const std::string& fname, bool dense)
+{
+    Sio::NumpyFrameSource source;
+    auto cfg = source.default_configuration();
+    cfg["filename"] = fname;
+    cfg["dense"] = dense;
+    source.configure(cfg);
+
+    std::vector<IFrame::pointer> frames;
+    while (true) {
+        IFrame::pointer frame;
+        Assert(source(frame));
+        if (!frame) {
+            break;
+        }
+        Assert(frame->time() == (7 + frames.size())*units::ms);
+        frames.push_back(frame);
+    }
+    IFrame::pointer end;
+    Assert(!source(end));
+    return frames;
+}
+
+// Samples saved as packed uint12, on an odd number of channels and
+// so with padded rows and an odd number of sparse samples, must come
+// back rounded and saturated at 0 and 4095.
+static void check_uint12()
+{
+    const std::vector<float> vals{0, 4095, 5000, -3, 4095.4, 4095.6, -0.4, 1234, 2048.5, 1};
+    auto want = [](float val) {
+        return std::min(4095.0f, std::max(0.0f, std::round(val)));
+    };
+    const int nchans = 5;
+    ITrace::vector traces;
+    for (int ch=0; ch<nchans; ++ch) {
+        ITrace::ChargeSequence charge(vals.begin(), vals.end());
+        std::rotate(charge.begin(), charge.begin() + ch, charge.end());
+        traces.push_back(std::make_shared<SimpleTrace>(ch, 0, charge));
+    }
+    const std::vector<IFrame::pointer> frames{
+        std::make_shared<SimpleFrame>(0, 7*units::ms, traces, 0.5*units::us)};
+
+    const std::string dname = "test_numpyframesource_uint12_dense.npz";
+    const std::string sname = "test_numpyframesource_uint12_sparse.npz";
+    Configuration cfg;
+    cfg["dtype"] = "uint12";
+    save(dname, cfg, frames);
+    cfg["sparse"] = true;
+    save(sname, cfg, frames);
+    {
+        Sio::NpzReader reader(dname);
+        const auto arr = reader.get("frame__0");
+        Assert(arr.is_type<uint8_t>());
+        Assert(arr.shape.size() == 2 and arr.shape[0] == vals.size() and arr.shape[1] == 9);
+    }
+    {
+        Sio::NpzReader reader(sname);
+        const auto nsamples = reader.get("trace_offsets__0").copy<int>().back();
+        Assert(nsamples == nchans*((int)vals.size() - 1)); // one zero per channel
+        Assert(nsamples % 2);
+        Assert(reader.get("samples__0").num_vals() == (size_t)(3*(nsamples+1)/2));
+    }
+
+    for (const auto& fname : {dname, sname}) {
+        const auto loaded = load(fname, true);
+        Assert(loaded.size() == 1);
+        const auto got = by_channel(loaded[0]);
+        Assert(got.size() == (size_t)nchans);
+        for (int ch=0; ch<nchans; ++ch) {
+            const auto& samples = got.at(ch).second;
+            Assert(samples.size() == vals.size());
+            for (size_t ind=0; ind<vals.size(); ++ind) {
+                Assert(samples[ind] == want(vals[(ind + ch) % vals.size()]));
+            }
+        }
+        remove(fname.c_str());
+    }
+    std::cerr << "uint12: ok\n";
+}
+
+int main()
+{
+    check_uint12();
+    for (std::string dtype : {"float32", "int16", "uint16"}) {
+        const std::string dname = "test_numpyframesource_dense.npz";
+        const std::string sname = "test_numpyframesource_sparse.npz";
+        Configuration cfg;
+        cfg["dtype"] = dtype;
+        cfg["baseline"] = 1.5;
+        cfg["scale"] = 2.0;
+        cfg["offset"] = 0.25;
+        const std::vector<IFrame::pointer> frames{make_frame(7), make_frame(8)};
+        save(dname, cfg, frames);
+        cfg["sparse"] = true;
+        save(sname, cfg, frames);
+
+        // Outside of runs the dense frame holds the scaled baseline.
+        const float background = (dtype == "float32") ? 1.5*2.0 + 0.25 : 3.0;
+        {
+            Sio::NpzReader reader(sname);
+            const auto tickinfo = reader.get("tickinfo__0").copy<double>();
+            Assert(tickinfo.size() == 5);
+            Assert(tickinfo[2] == 5);       // first tbin
+            Assert(tickinfo[3] == 34 - 5);  // ticks of the dense frame
+            Assert(tickinfo[4] == background);
+            Assert(!reader.has("frame__0"));
+        }
+
+        std::vector<Traces> dense, rebuilt;
+        for (const auto& frame : load(dname, true)) {
+            dense.push_back(by_channel(frame));
+        }
+        for (const auto& frame : load(sname, true)) {
+            rebuilt.push_back(by_channel(frame));
+        }
+        Assert(dense.size() == 2);
+        Assert(dense == rebuilt);
+
+        const auto& chan3 = dense[0].at(3);
+        Assert(chan3.first == 5 and chan3.second.size() == 29);
+        Assert(chan3.second[0] == background);
+        if (dtype == "float32") {
+            Assert(chan3.second[10-5] == (1 + 1.5)*2 + 0.25);
+        }
+        for (float val : dense[0].at(7).second) { // no runs on this channel
+            Assert(val == background);
+        }
+
+        // One trace per run, each matching the dense samples.
+        const auto runs = load(sname, false);
+        Assert(runs.size() == 2);
+        size_t nsamples = 0;
+        for (const auto& run : *runs[0]->traces()) {
+            Assert(run->channel() != 7);
+            const auto& want = dense[0].at(run->channel());
+            const int beg = run->tbin() - want.first;
+            const auto& charge = run->charge();
+            Assert(!charge.empty());
+            for (size_t ind=0; ind<charge.size(); ++ind) {
+                Assert(charge[ind] == want.second[beg + ind]);
+            }
+            nsamples += charge.size();
+        }
+        Assert(nsamples == 4 + 2 + 2); // ticks with a nonzero sample
+        std::cerr << dtype << ": ok\n";
+        remove(dname.c_str());
+        remove(sname.c_str());
+    }
+    std::cerr << "test_numpyframesource: ok\n";
+    return 0;
+}